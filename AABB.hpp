@@ -0,0 +1,52 @@
+#pragma once
+#include "Vector.hpp"
+#include "Ray.hpp"
+
+struct AABB {
+    Vec3 min;
+    Vec3 max;
+
+    // empty box, extending it with anything yields that thing
+    constexpr AABB() : min(INF), max(-INF) {}
+    constexpr AABB(const Vec3 &m, const Vec3 &M) : min(m), max(M) {}
+
+    static constexpr AABB Unbounded() { return AABB(Vec3(-INF), Vec3(INF)); }
+
+    constexpr void extend(const Vec3 &p) {
+        min = component_min(min, p);
+        max = component_max(max, p);
+    }
+    constexpr void extend(const AABB &b) {
+        min = component_min(min, b.min);
+        max = component_max(max, b.max);
+    }
+
+    constexpr Vec3 center() const { return (min + max) * Float(0.5); }
+    constexpr Vec3 extent() const { return max - min; }
+
+    constexpr bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    constexpr bool unbounded() const { return extent().max() == INF; }
+
+    constexpr Float area() const {
+        if (empty())
+            return 0;
+        const Vec3 e = extent();
+        return Float(2) * (e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+
+    constexpr int longest_axis() const {
+        const Vec3 e = extent();
+        return (e.x > e.y && e.x > e.z) ? 0 : (e.y > e.z ? 1 : 2);
+    }
+
+    // slab test, returns the entry distance or INF if [0, tmax] misses the box
+    inline Float hit(const Vec3 &origin, const Vec3 &inv_dir, Float tmax) const {
+        const Vec3 t0 = (min - origin) * inv_dir;
+        const Vec3 t1 = (max - origin) * inv_dir;
+        const Vec3 tn = component_min(t0, t1);
+        const Vec3 tf = component_max(t0, t1);
+        const Float enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, Float(0)));
+        const Float exit = std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+        return enter <= exit ? enter : INF;
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include "Vector.hpp"
+#include "Color.hpp"
+#include <cstdint>
+
+// what the denoiser gets from the first hit of a camera ray, all zero where it escaped
+struct Features {
+    Vec3 albedo;
+    Vec3 normal;
+    Float depth{ 0 };
+
+    inline void operator+=(const Features &f) {
+        albedo += f.albedo;
+        normal += f.normal;
+        depth += f.depth;
+    }
+};
+
+// running estimate of one pixel, variance is tracked on luminance
+struct PixelEstimate {
+    Vec3 sum;
+    double lum{ 0 };
+    double lum_sqr{ 0 };
+    uint32_t count{ 0 };
+    Features features; // summed over the samples like sum
+
+    inline void add(const Vec3 &L) {
+        const double l = luminance(L);
+        sum += L;
+        lum += l;
+        lum_sqr += l * l;
+        count++;
+    }
+
+    inline void add(const Vec3 &L, const Features &f) {
+        add(L);
+        features += f;
+    }
+
+    inline Vec3 mean() const { return count ? sum / Float(count) : Vec3(0); }
+
+    inline Features meanFeatures() const {
+        if (!count)
+            return Features();
+        const Float inv = Float(1) / count;
+        return { features.albedo * inv, features.normal * inv, features.depth * inv };
+    }
+
+    // variance of mean() in luminance
+    inline Float variance() const {
+        if (count < 2)
+            return INF;
+        const double m = lum / count;
+        return std::max(0.0, (lum_sqr - lum * m) / (count - 1)) / count;
+    }
+
+    /*
+        Standard error of the mean luminance, relative to its square root so
+        dark pixels are judged about the way they will be seen after tone mapping.
+    */
+    inline Float error() const {
+        if (count < 2)
+            return INF;
+        const double m = lum / count;
+        const double var = std::max(0.0, (lum_sqr - lum * m) / (count - 1));
+        return std::sqrt(var / count) / std::sqrt(std::max(m, 1e-3));
+    }
+};
+
+/*
+    Adaptive sampling spends at least minSamples on every pixel, then keeps
+    doubling the samples of pixels whose error() is above threshold, up to
+    maxSamples per pixel, until the tile has used N samples per pixel on average.
+    threshold = 0 turns it off, every pixel gets N samples.
+*/
+struct AdaptiveSettings {
+    Float threshold{ 0 };
+    uint32_t minSamples{ 8 };
+    uint32_t maxSamples{ 256 };
+};
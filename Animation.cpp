@@ -0,0 +1,152 @@
+#include "Animation.hpp"
+#include "Transform.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// what the sphere at i was called before the first build
+inline uint32_t sphere_id(const Scene &scene, uint32_t i) {
+    return scene.sphereIds.empty() ? i : scene.sphereIds[i];
+}
+
+// scale, turn around the y axis, then move, about pivot
+Transform pose(const Vec3 &translation, Float degrees, Float scale, const Vec3 &pivot) {
+    return Transform::translate(pivot + translation) * Transform::rotate(Vec3(0, 1, 0), degrees * Float(PI / 180))
+         * Transform::scale(scale) * Transform::translate(-pivot);
+}
+
+}
+
+bool Animation::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << path << ": can't read file\n";
+        return false;
+    }
+    m_tracks.clear();
+    m_frames = 0;
+    std::string line;
+    for (int n = 1; std::getline(in, line); n++) {
+        std::istringstream words(line);
+        std::string target;
+        if (!(words >> target) || target.starts_with('#'))
+            continue;
+        Track track{};
+        Key key{ 0, Vec3(0), 0, 1 };
+        if (target == "sphere")
+            track.target = SPHERE;
+        else if (target == "plane")
+            track.target = PLANE;
+        else if (target == "mesh")
+            track.target = MESH;
+        else {
+            std::cerr << path << ":" << n << ": unknown object " << target << "\n";
+            return false;
+        }
+        if (!(words >> track.index >> key.frame >> key.translation.x >> key.translation.y >> key.translation.z)) {
+            std::cerr << path << ":" << n << ": expected " << target << " index frame tx ty tz [degrees [scale]]\n";
+            return false;
+        }
+        if (words >> key.degrees)
+            words >> key.scale;
+
+        auto t = std::find_if(m_tracks.begin(), m_tracks.end(), [&](const Track &other) {
+            return other.target == track.target && other.index == track.index;
+        });
+        if (t == m_tracks.end()) {
+            m_tracks.push_back(std::move(track));
+            t = m_tracks.end() - 1;
+        }
+        t->keys.push_back(key);
+        m_frames = std::max(m_frames, key.frame + 1);
+    }
+    for (Track &track : m_tracks)
+        std::stable_sort(track.keys.begin(), track.keys.end(), [](const Key &a, const Key &b) { return a.frame < b.frame; });
+    return true;
+}
+
+bool Animation::bind(const Scene &scene, const std::vector<Part> &parts) {
+    m_sphereTrack.assign(scene.spheres.size(), -1);
+    for (uint32_t t = 0; t < m_tracks.size(); t++) {
+        Track &track = m_tracks[t];
+        const size_t count = track.target == SPHERE ? scene.spheres.size() : track.target == PLANE ? scene.planes.size() : parts.size();
+        if (track.index >= count) {
+            const char *names[] = { "sphere", "plane", "mesh" };
+            std::cerr << "animation: no " << names[track.target] << " " << track.index << ", the scene has " << count << "\n";
+            return false;
+        }
+        if (track.target == SPHERE) {
+            m_sphereTrack[track.index] = t;
+            uint32_t i = 0;
+            while (sphere_id(scene, i) != track.index)
+                i++;
+            track.pivot = scene.spheres[i].position;
+            track.radius = scene.spheres[i].radius;
+        }
+        else if (track.target == PLANE) {
+            const Plane &plane = scene.planes[track.index];
+            track.normal = plane.position;
+            track.pivot = plane.position * plane.hesse_const;
+        }
+        else {
+            track.part = parts[track.index];
+            const auto first = scene.mesh.vertices.begin() + track.part.vertex;
+            track.vertices.assign(first, first + track.part.vertices);
+            if (!scene.mesh.normals.empty()) {
+                const auto n = scene.mesh.normals.begin() + track.part.vertex;
+                track.normals.assign(n, n + track.part.vertices);
+            }
+            AABB bounds;
+            for (const Vec3 &v : track.vertices)
+                bounds.extend(v);
+            track.pivot = bounds.empty() ? Vec3(0) : bounds.center();
+        }
+    }
+    return true;
+}
+
+void Animation::apply(Scene &scene, uint32_t frame) const {
+    std::vector<Transform> poses(m_tracks.size());
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        const std::vector<Key> &keys = m_tracks[t].keys;
+        const auto next = std::upper_bound(keys.begin(), keys.end(), frame, [](uint32_t f, const Key &k) { return f < k.frame; });
+        Key key = next == keys.begin() ? keys.front() : *(next - 1);
+        if (next != keys.begin() && next != keys.end()) {
+            const Float s = Float(frame - key.frame) / (next->frame - key.frame);
+            key.translation = key.translation * (1 - s) + next->translation * s;
+            key.degrees = key.degrees * (1 - s) + next->degrees * s;
+            key.scale = key.scale * (1 - s) + next->scale * s;
+        }
+        poses[t] = pose(key.translation, key.degrees, key.scale, m_tracks[t].pivot);
+    }
+
+    // spheres move around in the BVH order, their ids follow them
+    for (uint32_t i = 0; i < scene.spheres.size(); i++) {
+        const int t = m_sphereTrack[sphere_id(scene, i)];
+        if (t < 0)
+            continue;
+        const Transform &T = poses[t];
+        scene.spheres[i].position = T.point(m_tracks[t].pivot);
+        scene.spheres[i].radius = m_tracks[t].radius * T.vector(Vec3(1, 0, 0)).norm();
+    }
+
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        const Track &track = m_tracks[t];
+        const Transform &T = poses[t];
+        if (track.target == PLANE) {
+            // no shear, the normal turns like any other vector
+            Plane &plane = scene.planes[track.index];
+            plane.position = T.vector(track.normal).normalize();
+            plane.hesse_const = plane.position.dot(T.point(track.pivot));
+        }
+        else if (track.target == MESH) {
+            for (uint32_t v = 0; v < track.part.vertices; v++)
+                scene.mesh.vertices[track.part.vertex + v] = T.point(track.vertices[v]);
+            for (uint32_t v = 0; v < track.normals.size(); v++)
+                scene.mesh.normals[track.part.vertex + v] = T.vector(track.normals[v]).normalize();
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "Scene.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+    Keyframed motion of spheres, planes and mesh parts for rendering
+    sequences. A keyframe file has one key per line,
+      sphere|plane|mesh index frame tx ty tz [degrees [scale]]
+    where index counts spheres and planes in the order the scene generates
+    them and meshes in the order of --mesh. At a key the object is scaled,
+    turned by degrees around the y axis and moved by t, all relative to its
+    rest pose and about its pivot: the center of a sphere or of a mesh part's
+    bounds, the point of a plane closest to the origin. Between keys the
+    values are interpolated linearly, outside them the nearest key holds.
+    Empty lines and lines starting with # are skipped.
+*/
+class Animation {
+public:
+    // vertices of one --mesh part in Scene::mesh
+    struct Part {
+        uint32_t vertex; // first
+        uint32_t vertices;
+    };
+
+    // prints the reason and returns false if the file can't be read or parsed
+    bool load(const std::string &path);
+
+    /*
+        Remembers the rest pose of the keyed objects of a scene, built or not,
+        whose mesh parts are parts. Prints the reason and returns false if a
+        key names an object the scene doesn't have.
+    */
+    bool bind(const Scene &scene, const std::vector<Part> &parts);
+
+    // moves the keyed objects to where they are at frame, the scene has to be refit or rebuilt afterwards
+    void apply(Scene &scene, uint32_t frame) const;
+
+    // one after the last key
+    inline uint32_t frames() const { return m_frames; }
+
+private:
+    enum Target { SPHERE, PLANE, MESH };
+
+    struct Key {
+        uint32_t frame;
+        Vec3 translation;
+        Float degrees;
+        Float scale;
+    };
+
+    struct Track {
+        Target target;
+        uint32_t index;
+        std::vector<Key> keys; // by frame
+        // rest pose
+        Vec3 pivot;
+        Vec3 normal;  // plane
+        Float radius; // sphere
+        Part part;    // mesh
+        std::vector<Vec3> vertices, normals;
+    };
+
+    std::vector<Track> m_tracks;
+    std::vector<int> m_sphereTrack; // track of every sphere by id, see Scene::sphereIds, -1 if it doesn't move
+    uint32_t m_frames{ 0 };
+};
@@ -0,0 +1,135 @@
+#include "BVH.hpp"
+#include <algorithm>
+#include <chrono>
+
+void BVH::build(const std::vector<AABB> &bounds, int packet) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    m_packet = packet;
+    nodes.clear();
+    indices.resize(bounds.size());
+    std::vector<BuildItem> items(bounds.size());
+    for (uint32_t i = 0; i < bounds.size(); i++) {
+        items[i].index = i;
+        items[i].bounds = bounds[i];
+        items[i].center = bounds[i].center();
+    }
+
+    if (!items.empty()) {
+        nodes.reserve(2 * items.size());
+        buildRecursive(items, 0, items.size(), 0);
+    }
+    for (uint32_t i = 0; i < items.size(); i++)
+        indices[i] = items[i].index;
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    buildTime = std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+Float BVH::sah() const {
+    if (nodes.empty() || nodes[0].bounds.area() <= 0)
+        return 0;
+    Float cost = 0;
+    for (const BVHNode &node : nodes)
+        cost += node.bounds.area() * (node.leaf() ? this->cost(node.count) : 1);
+    return cost / nodes[0].bounds.area();
+}
+
+uint32_t BVH::buildRecursive(std::vector<BuildItem> &items, uint32_t begin, uint32_t end, int depth) {
+    const uint32_t index = nodes.size();
+    nodes.emplace_back();
+
+    AABB bounds, centers;
+    for (uint32_t i = begin; i < end; i++) {
+        bounds.extend(items[i].bounds);
+        centers.extend(items[i].center);
+    }
+    nodes[index].bounds = bounds;
+
+    const uint32_t count = end - begin;
+    auto make_leaf = [&]() {
+        nodes[index].offset = begin;
+        nodes[index].count = count;
+        nodes[index].axis = 0;
+        return index;
+    };
+
+    auto make_inner = [&](int axis, uint32_t middle) {
+        nodes[index].axis = axis;
+        buildRecursive(items, begin, middle, depth + 1);
+        nodes[index].offset = buildRecursive(items, middle, end, depth + 1);
+        nodes[index].count = 0;
+        return index;
+    };
+
+    // a leaf holds at most 0xFFFF primitives, larger ranges are halved where the SAH gives up
+    const bool fits = count <= 0xFFFF;
+    if (count <= uint32_t(std::max(MAX_LEAF, m_packet)))
+        return make_leaf();
+
+    const int axis = centers.longest_axis();
+    const Float cmin = centers.min[axis];
+    const Float cext = centers.max[axis] - cmin;
+    if (depth >= MAX_DEPTH || cext <= 0) {
+        if (fits)
+            return make_leaf();
+        const uint32_t middle = begin + count / 2;
+        std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+            [&](const BuildItem &a, const BuildItem &b) { return a.center[axis] < b.center[axis]; });
+        return make_inner(axis, middle);
+    }
+
+    struct Bin {
+        AABB bounds;
+        uint32_t count{ 0 };
+    } bins[BINS];
+
+    const Float scale = BINS / cext;
+    auto bin_of = [&](const BuildItem &item) {
+        return std::min(int((item.center[axis] - cmin) * scale), BINS - 1);
+    };
+
+    for (uint32_t i = begin; i < end; i++) {
+        Bin &b = bins[bin_of(items[i])];
+        b.bounds.extend(items[i].bounds);
+        b.count++;
+    }
+
+    // sweep from the right to get the cost of every right side, then from the left
+    Float right_cost[BINS - 1];
+    AABB acc;
+    uint32_t acc_count = 0;
+    for (int i = BINS - 1; i > 0; i--) {
+        acc.extend(bins[i].bounds);
+        acc_count += bins[i].count;
+        right_cost[i - 1] = acc.area() * cost(acc_count);
+    }
+
+    int split = -1;
+    Float best = INF;
+    acc = AABB();
+    acc_count = 0;
+    for (int i = 0; i < BINS - 1; i++) {
+        acc.extend(bins[i].bounds);
+        acc_count += bins[i].count;
+        const Float c = acc.area() * cost(acc_count) + right_cost[i];
+        if (c < best) {
+            best = c;
+            split = i;
+        }
+    }
+
+    // traversal step is assumed to be as expensive as one primitive test
+    const Float leaf_cost = bounds.area() * cost(count);
+    const Float split_cost = bounds.area() + best;
+    if (split_cost >= leaf_cost && fits)
+        return make_leaf();
+
+    BuildItem *mid = std::partition(items.data() + begin, items.data() + end,
+        [&](const BuildItem &item) { return bin_of(item) <= split; });
+    uint32_t middle = mid - items.data();
+    if (middle == begin || middle == end)
+        middle = begin + count / 2;
+
+    return make_inner(axis, middle);
+}
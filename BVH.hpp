@@ -0,0 +1,134 @@
+#pragma once
+#include "AABB.hpp"
+#include "Stats.hpp"
+#include <vector>
+#include <cstdint>
+
+struct BVHNode {
+    AABB bounds;
+    uint32_t offset; // leaf: first index into BVH::indices (users may repurpose), inner: index of the second child
+    uint16_t count;  // number of primitives, 0 for inner nodes
+    uint16_t axis;   // split axis, used to visit the nearer child first
+
+    constexpr bool leaf() const { return count > 0; }
+};
+
+/*
+    Binary BVH over a set of primitive bounds, built with binned SAH.
+    The first child of an inner node is stored directly after it.
+    Leaves reference a range in `indices`, which maps back to the primitives.
+*/
+class BVH {
+public:
+    static constexpr int BINS = 16;
+    static constexpr int MAX_LEAF = 4;
+    static constexpr int MAX_DEPTH = 62;
+    static constexpr int STACK_SIZE = MAX_DEPTH + 18; // past MAX_DEPTH only ranges too large for a leaf are halved
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+    double buildTime{ 0 }; // ms
+
+    /*
+        packet is the number of primitives a leaf tests at once, the SAH counts
+        leaf cost in packets and never splits a range that fits into one.
+    */
+    void build(const std::vector<AABB> &bounds, int packet = 1);
+
+    inline bool empty() const { return nodes.empty(); }
+
+    /*
+        Keeps the tree and recomputes its bounds bottom up after the primitives
+        moved, bounds(leaf) returns the box around a leaf's primitives. Much
+        cheaper than build(), but the tree gets slower to traverse the further
+        the primitives move from where it was built, see sah().
+    */
+    template <typename F>
+    void refit(F &&bounds) {
+        // children come after their parent
+        for (size_t i = nodes.size(); i-- > 0;) {
+            BVHNode &node = nodes[i];
+            if (node.leaf())
+                node.bounds = bounds(node);
+            else {
+                node.bounds = nodes[i + 1].bounds;
+                node.bounds.extend(nodes[node.offset].bounds);
+            }
+        }
+    }
+
+    // expected cost of a ray through the tree, in node visits and leaf packets, relative to the root's area
+    Float sah() const;
+
+    /*
+        Visits the leaves front to back. intersect(leaf, tmax) tests the leaf's
+        primitives, shrinks tmax on a closer hit and returns true if it did so.
+        Returns true if any primitive was hit. With ANY it returns at the first
+        leaf that reports a hit, for occlusion queries. root is the node to start
+        at, when nodes holds several trees.
+    */
+    template <bool ANY = false, typename F>
+    bool traverse(const Ray &ray, Float tmax, F &&intersect, uint32_t root = 0) const {
+        if (nodes.empty())
+            return false;
+
+        const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+        const bool negative[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        uint32_t current = root;
+        bool found = false;
+
+        if (nodes[root].bounds.hit(ray.position, inv_dir, tmax) == INF)
+            return false;
+
+        while (true) {
+            const BVHNode &node = nodes[current];
+            STAT(threadStats.nodes++);
+            if (node.leaf()) {
+                if (intersect(node, tmax)) {
+                    if constexpr (ANY)
+                        return true;
+                    found = true;
+                }
+            }
+            else {
+                uint32_t near = current + 1;
+                uint32_t far = node.offset;
+                if (negative[node.axis])
+                    std::swap(near, far);
+
+                const Float tn = nodes[near].bounds.hit(ray.position, inv_dir, tmax);
+                const Float tf = nodes[far].bounds.hit(ray.position, inv_dir, tmax);
+                if (tn != INF) {
+                    if (tf != INF)
+                        stack[top++] = far;
+                    current = near;
+                    continue;
+                }
+                if (tf != INF) {
+                    current = far;
+                    continue;
+                }
+            }
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+
+        return found;
+    }
+
+private:
+    struct BuildItem {
+        AABB bounds;
+        Vec3 center;
+        uint32_t index;
+    };
+
+    int m_packet{ 1 };
+
+    uint32_t buildRecursive(std::vector<BuildItem> &items, uint32_t begin, uint32_t end, int depth);
+    inline Float cost(uint32_t count) const { return Float((count + m_packet - 1) / m_packet); }
+};
@@ -0,0 +1,520 @@
+#include "Integrator.hpp"
+#include "Wavefront.hpp"
+#include "Camera.hpp"
+#include "Scenes.hpp"
+#include "Color.hpp"
+#include "Kernels.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <cstring>
+
+/*
+    Benchmarks of the intersection and shading kernels on fixed random inputs,
+    and of full renders of the canonical scenes at a reduced resolution.
+    The report is JSON (stdout or --json file), progress goes to stderr.
+    All inputs come from fixed seeds, so the reports of two versions can be
+    compared number by number. A few correctness checks run first, the
+    benchmarks don't start if one fails.
+*/
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double minTime = 0.25;  // seconds every kernel measurement runs at least
+volatile Float sink;    // keeps the results of the kernels alive
+
+// calls f, which does `calls` calls of a kernel, until minTime has passed, returns ns per call
+template <typename F>
+double measure(size_t calls, F &&f) {
+    f();
+    size_t runs = 0;
+    const auto start = Clock::now();
+    double elapsed;
+    do {
+        f();
+        runs++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minTime);
+    return elapsed * 1e9 / (double(runs) * calls);
+}
+
+struct Report {
+    std::ostringstream json;
+    bool first{ true };
+
+    void entry(const std::string &name) {
+        json << (first ? "\n" : ",\n") << "    \"" << name << "\": ";
+        first = false;
+    }
+};
+
+void kernels(Report &report) {
+    constexpr size_t RAYS = 1 << 16;
+    constexpr size_t PRIMITIVES = 64;
+
+    Sampler rng(Sampler::RANDOM, 1);
+    rng.start(0, 0);
+    auto point = [&]() { return Vec3(rng.get1D(), rng.get1D(), rng.get1D()) * 4 - Vec3(2); };
+
+    std::vector<Ray> rays;
+    std::vector<Vec3> normals, colors;
+    std::vector<Vec2> samples;
+    for (size_t i = 0; i < RAYS; i++) {
+        rays.emplace_back(point(), random_unit_vector(rng.get2D()));
+        normals.push_back(random_unit_vector(rng.get2D()));
+        samples.push_back(rng.get2D());
+        colors.push_back(Vec3(rng.get1D(), rng.get1D(), rng.get1D()) * 4);
+    }
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i < PRIMITIVES; i++) {
+        spheres.emplace_back(point(), 0.3 + 0.5 * rng.get1D(), 0);
+        planes.emplace_back(random_unit_vector(rng.get2D()), rng.get1D() * 4 - 2, 0);
+        triangles.emplace_back(point(), random_unit_vector(rng.get2D()) * 2, random_unit_vector(rng.get2D()) * 2, 0);
+    }
+
+    auto result = [&](const std::string &name, double ns) {
+        std::cerr << "  " << name << ": " << ns << " ns\n";
+        report.entry(name);
+        report.json << "{ \"ns\": " << ns << ", \"mcalls_per_s\": " << 1e3 / ns << " }";
+    };
+
+    // one ray against one primitive per call
+    auto primitive = [&](const std::string &name, const auto &primitives) {
+        result(name, measure(RAYS, [&]() {
+            Float s = 0;
+            for (size_t i = 0; i < RAYS; i++) {
+                Interaction interaction(&rays[i]);
+                if (primitives[i % PRIMITIVES].hit(&interaction))
+                    s += interaction.t;
+            }
+            sink = sink + s;
+        }));
+    };
+    primitive("Sphere::hit", spheres);
+    primitive("Plane::hit", planes);
+    primitive("Triangle::hit", triangles);
+
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+    // one ray against all primitives in packets of LANES, per primitive test
+    SphereSoA sphereSoA;
+    PlaneSoA planeSoA;
+    TriangleSoA triangleSoA;
+    sphereSoA.build(spheres);
+    planeSoA.build(planes);
+    triangleSoA.build(triangles);
+    result("hit_spheres", measure(RAYS * PRIMITIVES, [&]() {
+        int s = 0;
+        for (size_t i = 0; i < RAYS; i++) {
+            Float t = INF;
+            s += hit_spheres(sphereSoA, 0, PRIMITIVES, rays[i], t, -1);
+        }
+        sink = sink + s;
+    }));
+    result("hit_planes", measure(RAYS * PRIMITIVES, [&]() {
+        int s = 0;
+        for (size_t i = 0; i < RAYS; i++) {
+            Float t = INF;
+            s += hit_planes(planeSoA, 0, PRIMITIVES, rays[i], t, -1);
+        }
+        sink = sink + s;
+    }));
+    result("hit_triangles", measure(RAYS * PRIMITIVES, [&]() {
+        int s = 0;
+        for (size_t i = 0; i < RAYS; i++) {
+            Float t = INF;
+            Vec3 uv;
+            s += hit_triangles(triangleSoA, 0, PRIMITIVES, rays[i], t, uv, -1);
+        }
+        sink = sink + s;
+    }));
+#endif
+
+    result("fresnel", measure(RAYS, [&]() {
+        Float s = 0;
+        for (size_t i = 0; i < RAYS; i++)
+            s += fresnel(rays[i].direction, normals[i], 1.0, 1.5);
+        sink = sink + s;
+    }));
+    result("random_hemi_vector", measure(RAYS, [&]() {
+        Float s = 0;
+        for (size_t i = 0; i < RAYS; i++)
+            s += random_hemi_vector(normals[i], samples[i]).x;
+        sink = sink + s;
+    }));
+    result("cosine_hemi_vector", measure(RAYS, [&]() {
+        Float s = 0;
+        for (size_t i = 0; i < RAYS; i++)
+            s += cosine_hemi_vector(normals[i], samples[i]).x;
+        sink = sink + s;
+    }));
+    result("ACESFilm", measure(RAYS, [&]() {
+        Float s = 0;
+        for (size_t i = 0; i < RAYS; i++)
+            s += ACESFilm(colors[i]).g;
+        sink = sink + s;
+    }));
+
+    // camera rays into the rendered scene, one intersection and one scatter each
+    Scene scene;
+    Sampler sceneRng(Sampler::RANDOM, 0);
+    sceneRng.start(~0u, 0);
+    spheres_scene(scene, sceneRng);
+    scene.build();
+    const Camera camera(320, 180);
+    std::vector<Ray> cameraRays;
+    std::vector<Sampler> samplers;
+    for (size_t i = 0; i < RAYS; i++) {
+        Sampler sampler(Sampler::SOBOL, 0);
+        sampler.start(i, 0);
+        cameraRays.push_back(camera.ray(i % camera.width, (i / camera.width) % camera.height, sampler));
+        samplers.push_back(sampler);
+    }
+    result("Li (single bounce)", measure(RAYS, [&]() {
+        Float s = 0;
+        for (size_t i = 0; i < RAYS; i++) {
+            Sampler sampler = samplers[i];
+            s += Li(scene, cameraRays[i], sampler, nullptr, 1).g;
+        }
+        sink = sink + s;
+    }));
+}
+
+/*
+    Closest hits of rays through the binary BVH of the scene and through the
+    quantized wide one: bytes per primitive, ns per ray and, when built with
+    RT_STATS, nodes visited per ray.
+*/
+void layouts(Report &report, Scene &scene, const std::vector<Ray> &coherent, const std::vector<Ray> &incoherent) {
+    const size_t primitives = std::max<size_t>(1, scene.spheres.size() + scene.triangles.size() + scene.mesh.triangles() + scene.instances.size());
+    const std::pair<const char*, size_t> bytes[] = {
+        { "binary", scene.bvh().nodes.size() * sizeof(BVHNode) },
+        { "wide", scene.wideBVH().bytes() },
+    };
+    report.json << ", \"bvh\": {";
+    for (const auto &[name, size] : bytes) {
+        scene.wide = name == bytes[1].first;
+        report.json << (scene.wide ? ", " : " ") << "\"" << name << "\": { \"bytes_per_primitive\": " << double(size) / primitives;
+        std::cerr << "    " << name << ": " << double(size) / primitives << " bytes/primitive";
+        const std::pair<const char*, const std::vector<Ray>&> sets[] = { { "camera", coherent }, { "random", incoherent } };
+        for (const auto &[set, rays] : sets) {
+            auto trace = [&]() {
+                int s = 0;
+                for (const Ray &ray : rays) {
+                    Interaction interaction(&ray);
+                    s += scene.intersect(&interaction);
+                }
+                sink = sink + s;
+            };
+            const double ns = measure(rays.size(), trace);
+            report.json << ", \"" << set << "\": { \"ns_per_ray\": " << ns;
+            std::cerr << ", " << set << " " << ns << " ns/ray";
+        #ifdef RT_STATS
+            const uint64_t nodes = threadStats.nodes;
+            trace();
+            const double steps = double(threadStats.nodes - nodes) / rays.size();
+            report.json << ", \"steps_per_ray\": " << steps;
+            std::cerr << " " << steps << " steps/ray";
+        #endif
+            report.json << " }";
+        }
+        report.json << " }";
+        std::cerr << "\n";
+    }
+    report.json << " }";
+    scene.wide = false;
+}
+
+// the closed cube [-1, 1]^3, its faces wound so that U x V points outwards
+Mesh cube_mesh() {
+    const Vec3 axes[3] = { Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1) };
+    Mesh cube;
+    for (int a = 0; a < 3; a++) {
+        for (int side : { -1, 1 }) {
+            const Vec3 n = axes[a] * side;
+            Vec3 t1 = axes[(a + 1) % 3], t2 = axes[(a + 2) % 3];
+            if (side < 0)
+                std::swap(t1, t2);
+            const uint32_t v = cube.vertices.size();
+            for (const Vec3 &c : { n - t1 - t2, n + t1 - t2, n + t1 + t2, n - t1 + t2 })
+                cube.vertices.push_back(c);
+            for (uint32_t i : { 0, 1, 2, 0, 2, 3 })
+                cube.indices.push_back(v + i);
+        }
+    }
+    return cube;
+}
+
+/*
+    Regressions the timings wouldn't show, run before every benchmark.
+    Prints what failed and returns false.
+*/
+bool checks() {
+    bool ok = true;
+    auto check = [&](bool passed, const std::string &what) {
+        if (!passed)
+            std::cerr << "  FAILED: " << what << "\n";
+        ok &= passed;
+    };
+
+    // rays leaving a closed mesh through its top miss it, as a mesh, as loose triangles and as an instance
+    const Mesh cube = cube_mesh();
+    for (const char *as : { "mesh", "triangles", "instance" }) {
+        Scene scene;
+        const uint32_t M = scene.addMaterial(DIFFUSE_WHITE);
+        if (as == std::string("mesh"))
+            scene.mesh.append(cube, M);
+        else if (as == std::string("instance"))
+            scene.instances.emplace_back(scene.addGeometry(cube, M), Transform());
+        else {
+            for (size_t i = 0; i < cube.indices.size(); i += 3) {
+                const Vec3 &p = cube.vertices[cube.indices[i]];
+                scene.triangles.emplace_back(p, cube.vertices[cube.indices[i + 1]] - p, cube.vertices[cube.indices[i + 2]] - p, M);
+            }
+        }
+        scene.build();
+        for (const bool wide : { false, true }) {
+            scene.wide = wide;
+            Sampler rng(Sampler::RANDOM, 2);
+            rng.start(0, 0);
+            int hits = 0, occluded = 0;
+            for (int i = 0; i < 1000; i++) {
+                const Vec3 origin(rng.get1D() * 2 - 1, 1, rng.get1D() * 2 - 1);
+                Vec3 direction = random_unit_vector(rng.get2D());
+                direction.y = std::abs(direction.y) + Float(0.01);
+                const Ray ray(origin, direction.normalize());
+                Interaction interaction(&ray);
+                hits += scene.intersect(&interaction);
+                occluded += scene.occluded(ray, INF);
+            }
+            check(hits == 0 && occluded == 0, std::string("rays leaving a closed cube (") + as + (wide ? ", wide BVH)" : ")") + " miss it, "
+                  + std::to_string(hits) + " hits and " + std::to_string(occluded) + " occluded of 1000");
+        }
+    }
+
+    // axis aligned rays, with zeros in the direction, find the same spheres in a row through both BVH layouts
+    Scene row;
+    const uint32_t M = row.addMaterial(DIFFUSE_WHITE);
+    for (int i = 0; i < 64; i++)
+        row.spheres.emplace_back(Vec3(i, 0, 0), Float(0.3), M);
+    row.build();
+    std::vector<Ray> rays = { Ray(Vec3(-5, 0, 0), Vec3(1, 0, 0)), Ray(Vec3(70, 0, 0), Vec3(-1, 0, 0)) };
+    for (int i = 0; i < 64; i++) {
+        rays.emplace_back(Vec3(i, -5, 0), Vec3(0, 1, 0));
+        rays.emplace_back(Vec3(i, 0, 5), Vec3(0, 0, -1));
+    }
+    int missed = 0, differ = 0;
+    for (const Ray &ray : rays) {
+        Interaction binary(&ray), wide(&ray);
+        row.wide = false;
+        const bool b = row.intersect(&binary);
+        row.wide = true;
+        const bool w = row.intersect(&wide);
+        missed += !b + !w;
+        differ += b != w || binary.object != wide.object || binary.t != wide.t;
+    }
+    check(!missed && !differ, "axis aligned rays hit a row of spheres the same in both BVH layouts, "
+          + std::to_string(missed) + " misses and " + std::to_string(differ) + " differences of " + std::to_string(rays.size()));
+
+    return ok;
+}
+
+/*
+    Takes every pixel of estimates up to target samples on `threads` threads,
+    interleaved by row, with the Sobol sequence scrambled by seed. Returns the
+    rays traced if wavefront is set, else 0.
+*/
+uint64_t render(const Scene &scene, const Camera &camera, std::vector<PixelEstimate> &estimates,
+                uint32_t target, bool wavefront, int threads, uint32_t seed = 0) {
+    std::vector<uint64_t> rays(threads, 0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            Wavefront paths;
+            Sampler sampler(Sampler::SOBOL, seed);
+            for (int y = t; y < camera.height; y += threads) {
+                PixelEstimate *row = &estimates[size_t(y) * camera.width];
+                for (int x = 0; x < camera.width; x++) {
+                    for (uint32_t n = row[x].count; n < target; n++) {
+                        sampler.start(y * camera.width + x, n);
+                        const Ray ray = camera.ray(x, y, sampler);
+                        if (wavefront)
+                            paths.add(ray, x, sampler);
+                        else
+                            row[x].add(Li(scene, ray, sampler));
+                    }
+                }
+                if (wavefront)
+                    paths.trace(scene, row);
+            }
+            rays[t] = paths.rays;
+        });
+    }
+    uint64_t total = 0;
+    for (int t = 0; t < threads; t++) {
+        pool[t].join();
+        total += rays[t];
+    }
+    return total;
+}
+
+// root mean square difference of all channels relative to the mean of the reference
+double error(const std::vector<PixelEstimate> &image, const std::vector<PixelEstimate> &reference) {
+    double diff = 0, mean = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        const Vec3 a = image[i].mean(), b = reference[i].mean();
+        const Vec3 d = a - b;
+        diff += d.x*d.x + d.y*d.y + d.z*d.z;
+        mean += b.x + b.y + b.z;
+    }
+    return std::sqrt(diff / (3.0 * image.size())) / std::max(mean / (3.0 * image.size()), 1e-9);
+}
+
+struct RenderSettings {
+    int width{ 320 };
+    int height{ 180 };
+    uint32_t spp{ 16 };
+    uint32_t referenceSpp{ 256 };
+    double noise{ 0.05 };
+    int threads{ 1 };
+};
+
+void scenes(Report &report, const RenderSettings &settings) {
+    struct Canonical {
+        const char *name;
+        void (*build)(Scene&);
+    };
+    const Canonical canonical[] = {
+        { "spheres", [](Scene &s) { Sampler rng(Sampler::RANDOM, 0); rng.start(~0u, 0); spheres_scene(s, rng); } },
+        { "triangles", [](Scene &s) { Sampler rng(Sampler::RANDOM, 0); rng.start(~0u, 0); triangles_scene(s, rng, 2000); } },
+        { "torus", [](Scene &s) { torus_scene(s, 256, 128); } },
+        { "lights", [](Scene &s) { torus_scene(s, 256, 128); add_lights(s); } },
+        { "instances", [](Scene &s) { Sampler rng(Sampler::RANDOM, 0); rng.start(~0u, 0); instances_scene(s, rng, 1024); } },
+    };
+
+    const Camera camera(settings.width, settings.height);
+    const size_t pixels = size_t(camera.width) * camera.height;
+    for (const Canonical &c : canonical) {
+        Scene scene;
+        c.build(scene);
+        scene.build();
+        std::cerr << "  " << c.name << "\n";
+
+        // the same samples with both integrators, the wavefront one counts the rays
+        std::vector<PixelEstimate> image(pixels);
+        auto start = Clock::now();
+        render(scene, camera, image, settings.spp, false, settings.threads);
+        const double li = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        image.assign(pixels, PixelEstimate());
+        start = Clock::now();
+        const uint64_t rays = render(scene, camera, image, settings.spp, true, settings.threads);
+        const double wf = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        // time until the image is within the noise target of a high sample count reference,
+        // whose samples are independent of the image's, it would start with the same ones
+        std::vector<PixelEstimate> reference(pixels);
+        render(scene, camera, reference, settings.referenceSpp, false, settings.threads, 1);
+        image.assign(pixels, PixelEstimate());
+        double elapsed = 0, e = INF;
+        uint32_t spp = 0;
+        while (spp < settings.referenceSpp / 4 && e > settings.noise) {
+            spp = std::max(1u, spp * 2);
+            start = Clock::now();
+            render(scene, camera, image, spp, false, settings.threads);
+            elapsed += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            e = error(image, reference);
+        }
+
+        report.entry(c.name);
+        report.json << "{ \"primitives\": " << scene.spheres.size() + scene.triangles.size() + scene.planes.size() + scene.mesh.triangles()
+                                             + scene.instances.size()
+                    << ", \"spp\": " << settings.spp << ", \"rays\": " << rays
+                    << ", \"li\": { \"ms\": " << li << ", \"mrays_per_s\": " << rays / li * 1e-3 << " }"
+                    << ", \"wavefront\": { \"ms\": " << wf << ", \"mrays_per_s\": " << rays / wf * 1e-3 << " }"
+                    << ", \"noise\": { \"target\": " << settings.noise << ", \"reached\": " << (e <= settings.noise ? "true" : "false")
+                    << ", \"error\": " << e << ", \"spp\": " << spp << ", \"ms\": " << elapsed
+                    << ", \"reference_spp\": " << settings.referenceSpp << " }";
+        std::cerr << "    " << rays / li * 1e-3 << " Mrays/s (Li), " << rays / wf * 1e-3 << " Mrays/s (wavefront), "
+                  << "error " << e << " at " << spp << " spp after " << elapsed << "ms\n";
+
+        // a camera ray per pixel, and rays from random points in the scene's bounds in random directions
+        std::vector<Ray> coherent, incoherent;
+        Sampler rng(Sampler::RANDOM, 1);
+        rng.start(0, 0);
+        const AABB bounds = scene.bvh().empty() ? AABB(Vec3(-1), Vec3(1)) : scene.bvh().nodes[0].bounds;
+        for (size_t i = 0; i < pixels; i++) {
+            Sampler sampler(Sampler::SOBOL, 0);
+            sampler.start(i, 0);
+            coherent.push_back(camera.ray(i % camera.width, i / camera.width, sampler));
+            const Vec3 u(rng.get1D(), rng.get1D(), rng.get1D());
+            incoherent.emplace_back(bounds.min + u * bounds.extent(), random_unit_vector(rng.get2D()));
+        }
+        layouts(report, scene, coherent, incoherent);
+        report.json << " }";
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    RenderSettings settings;
+    settings.threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string jsonPath;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            minTime = 0.05;
+            settings.width = 160;
+            settings.height = 90;
+            settings.spp = 4;
+            settings.referenceSpp = 64;
+            settings.noise = 0.1;
+        }
+        else if (!strcmp(argv[i], "--json") && i+1 < argc) {
+            jsonPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+            settings.threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--noise") && i+1 < argc) {
+            settings.noise = atof(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--json file] [--threads N] [--noise relative_error]\n";
+            return 1;
+        }
+    }
+
+    std::cerr << "checks\n";
+    if (!checks())
+        return 1;
+
+    Report kernelReport, sceneReport;
+    std::cerr << "kernels\n";
+    kernels(kernelReport);
+    std::cerr << "scenes (" << settings.width << "x" << settings.height << ", " << settings.threads << " threads)\n";
+    scenes(sceneReport, settings);
+
+    std::ostringstream json;
+    json << "{\n  \"lanes\": " << LANES << ",\n  \"threads\": " << settings.threads
+         << ",\n  \"width\": " << settings.width << ",\n  \"height\": " << settings.height
+         << ",\n  \"kernels\": {" << kernelReport.json.str() << "\n  },\n  \"scenes\": {" << sceneReport.json.str() << "\n  }\n}\n";
+
+    if (jsonPath.empty()) {
+        std::cout << json.str();
+        return 0;
+    }
+    std::ofstream f(jsonPath);
+    f << json.str();
+    if (!f) {
+        std::cerr << jsonPath << ": can't write report\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "Ray.hpp"
+#include "Sampler.hpp"
+#include "Transform.hpp"
+
+// pinhole at (0, 0, -0.5) looking down +z through an image plane of height 1 at z = 0, moved by toWorld
+struct Camera {
+    int width;
+    int height;
+    Float inv_pixel_size;
+    Transform toWorld;
+
+    Camera(int w, int h, const Transform &T = Transform()) : width(w), height(h), inv_pixel_size(1.0 / sqrt(Float(w)*w + Float(h)*h)), toWorld(T) {}
+
+    // puts the pinhole at eye looking at target, with +y up
+    static inline Transform look_at(const Vec3 &eye, const Vec3 &target) {
+        const Vec3 f = (target - eye).normalize();
+        const Vec3 r = Vec3(0, 1, 0).cross(f).normalize();
+        const Vec3 u = f.cross(r);
+        const Transform rotation(Vec3(r.x, u.x, f.x), Vec3(r.y, u.y, f.y), Vec3(r.z, u.z, f.z), Vec3(0));
+        return Transform::translate(eye) * rotation * Transform::translate(Vec3(0, 0, 0.5));
+    }
+
+    // jittered ray through pixel (x, y), draws one 2D sample
+    inline Ray ray(int x, int y, Sampler &sampler) const {
+        static const Vec3 P(0, 0, -0.5);
+        const Vec3 receiver((x - width*0.5+0.5)/height, (height*0.5 - y - 0.5)/height, 0);
+        const Vec3 dir = (receiver-P).normalize();
+        const Vec3 h = dir + random_hemi_vector(dir, sampler.get2D()) * inv_pixel_size;
+        return Ray::NormalizedRay(toWorld.point(P), toWorld.vector(h));
+    }
+};
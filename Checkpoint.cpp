@@ -0,0 +1,93 @@
+#include "Checkpoint.hpp"
+#include "MappedFile.hpp"
+#include <iostream>
+#include <cstdio>
+
+namespace {
+
+constexpr char MAGIC[4] = { 'R', 'T', 'C', 'K' };
+constexpr uint32_t VERSION = 1;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t seed;
+    uint32_t sampler;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelSize; // sizeof(PixelEstimate) of the writer
+    uint32_t reserved;
+};
+
+bool write_all(int fd, const void *data, size_t size) {
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::write(fd, p, size);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+bool Checkpoint::save(const std::string &path) const {
+    CheckpointHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    header.seed = seed;
+    header.sampler = sampler;
+    header.width = width;
+    header.height = height;
+    header.pixelSize = sizeof(PixelEstimate);
+
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << tmp << ": can't write checkpoint\n";
+        return false;
+    }
+    // synced before the rename, a crash leaves either the old or the new checkpoint
+    const bool ok = write_all(fd, &header, sizeof(header))
+                 && write_all(fd, pixels.data(), pixels.size() * sizeof(PixelEstimate))
+                 && fsync(fd) == 0;
+    close(fd);
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << path << ": can't write checkpoint\n";
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::load(const std::string &path) {
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    CheckpointHeader header;
+    if (file.size < sizeof(header)) {
+        std::cerr << path << ": not a checkpoint\n";
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    const uint64_t count = uint64_t(header.width) * header.height;
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION
+        || header.pixelSize != sizeof(PixelEstimate) || file.size != sizeof(header) + count * sizeof(PixelEstimate)) {
+        std::cerr << path << ": not a checkpoint of this version\n";
+        return false;
+    }
+
+    key = header.key;
+    seed = header.seed;
+    sampler = header.sampler;
+    width = header.width;
+    height = header.height;
+    const PixelEstimate *first = reinterpret_cast<const PixelEstimate*>(file.data + sizeof(header));
+    pixels.assign(first, first + count);
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "Adaptive.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+    State of a partially rendered frame: the linear accumulation buffer with the
+    sample count of every pixel, and what the samples depend on. The sampler is
+    counter based, the next sample of a pixel is determined by seed, sampler type
+    and its count, so that is all of its state.
+*/
+struct Checkpoint {
+    uint64_t key{ 0 }; // scene the pixels belong to, see Scene::hash
+    uint32_t seed{ 0 };
+    uint32_t sampler{ 0 };
+    uint32_t width{ 0 };
+    uint32_t height{ 0 };
+    std::vector<PixelEstimate> pixels;
+
+    /*
+        Replaces path atomically, the file is written and synced under a temporary
+        name and then renamed. Prints the reason and returns false on failure.
+    */
+    bool save(const std::string &path) const;
+
+    // false if there is no readable checkpoint at path, prints the reason if it is malformed
+    bool load(const std::string &path);
+};
@@ -1,9 +1,14 @@
+#pragma once
 #include "Vector.hpp"
 
 constexpr Float clamp(Float x, Float m=0, Float M=1) {
     return std::min(std::max(x, m), M);
 }
 
+constexpr Float luminance(const Vec3 &x) {
+    return Float(0.2126) * x.r + Float(0.7152) * x.g + Float(0.0722) * x.b;
+}
+
 constexpr Vec3 gammaCorrect(const Vec3 &x) {
     return Vec3(
         std::pow(x.r, 1/2.2),
@@ -0,0 +1,223 @@
+#include "Denoise.hpp"
+#include "Simd.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+constexpr Float KERNEL[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+constexpr Float EPSILON = 1e-6;
+constexpr Float ALBEDO_MIN = 0.01;    // escaped rays and lights have no albedo
+constexpr Float VARIANCE_MAX = 1e30;  // pixels with a single sample, keeps 0 * variance finite
+
+// the demodulated image, one plane per channel so the SIMD loops load neighbouring pixels at once
+struct Planes {
+    std::vector<Float> r, g, b, var;
+
+    void resize(size_t n) {
+        r.resize(n);
+        g.resize(n);
+        b.resize(n);
+        var.resize(n);
+    }
+};
+
+struct Guide {
+    std::vector<Float> nx, ny, nz, depth;
+};
+
+// one a-trous iteration
+struct Pass {
+    const Planes *in;
+    Planes *out;
+    const Float *variance; // in->var blurred
+    const Guide *guide;
+    int width, height;
+    int step;
+    const DenoiseSettings *settings;
+};
+
+// runs row(y) for every row, split into one band per thread
+template <typename F>
+void rows(int height, int threads, F &&row) {
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            for (int y = height * t / threads; y < height * (t + 1) / threads; y++)
+                row(y);
+        });
+    }
+    for (std::thread &thread : pool)
+        thread.join();
+}
+
+// 3x3 gaussian of the variance, the luminance weights of a single pixel's estimate are too noisy
+void blur_variance(const Planes &in, Float *out, int width, int height, int y) {
+    static constexpr Float G[3] = { 0.25, 0.5, 0.25 };
+    for (int x = 0; x < width; x++) {
+        Float sum = 0, weight = 0;
+        for (int i = -1; i <= 1; i++) {
+            if (y + i < 0 || y + i >= height)
+                continue;
+            for (int j = -1; j <= 1; j++) {
+                if (x + j < 0 || x + j >= width)
+                    continue;
+                const Float w = G[i + 1] * G[j + 1];
+                sum += w * in.var[(y + i) * width + x + j];
+                weight += w;
+            }
+        }
+        out[y * width + x] = sum / weight;
+    }
+}
+
+void filter(const Pass &p, int x, int y) {
+    const Planes &in = *p.in;
+    const Guide &g = *p.guide;
+    const int c = y * p.width + x;
+    const Float lc = luminance(Vec3(in.r[c], in.g[c], in.b[c]));
+    const Float invL = 1 / (p.settings->sigmaLuminance * std::sqrt(p.variance[c]) + EPSILON);
+    const Float invZ = 1 / (p.settings->sigmaDepth * p.step * g.depth[c] + EPSILON);
+
+    // the pixel itself counts fully, escaped pixels have no normal to compare
+    const Float w0 = KERNEL[2] * KERNEL[2];
+    Float sw = w0, sr = w0 * in.r[c], sg = w0 * in.g[c], sb = w0 * in.b[c], sv = w0 * w0 * in.var[c];
+    for (int i = -2; i <= 2; i++) {
+        const int yy = y + i * p.step;
+        if (yy < 0 || yy >= p.height)
+            continue;
+        for (int j = -2; j <= 2; j++) {
+            const int xx = x + j * p.step;
+            if ((i == 0 && j == 0) || xx < 0 || xx >= p.width)
+                continue;
+            const int q = yy * p.width + xx;
+            Float wn = std::max(Float(0), g.nx[c] * g.nx[q] + g.ny[c] * g.ny[q] + g.nz[c] * g.nz[q]);
+            for (int k = 0; k < p.settings->normalPower; k++)
+                wn *= wn;
+            const Float lq = luminance(Vec3(in.r[q], in.g[q], in.b[q]));
+            const Float w = KERNEL[i + 2] * KERNEL[j + 2] * wn
+                          * std::exp(-std::abs(lc - lq) * invL - std::abs(g.depth[c] - g.depth[q]) * invZ);
+            sw += w;
+            sr += w * in.r[q];
+            sg += w * in.g[q];
+            sb += w * in.b[q];
+            sv += w * w * in.var[q];
+        }
+    }
+
+    p.out->r[c] = sr / sw;
+    p.out->g[c] = sg / sw;
+    p.out->b[c] = sb / sw;
+    p.out->var[c] = sv / (sw * sw);
+}
+
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+// filter() of the LANES pixels from x on, all their taps have to be inside the row
+void filter_lanes(const Pass &p, int x, int y) {
+    const Planes &in = *p.in;
+    const Guide &g = *p.guide;
+    const int c = y * p.width + x;
+    auto lum = [](const FloatN &r, const FloatN &g, const FloatN &b) {
+        return r * FloatN(0.2126) + g * FloatN(0.7152) + b * FloatN(0.0722);
+    };
+
+    const FloatN cr = FloatN::load(&in.r[c]), cg = FloatN::load(&in.g[c]), cb = FloatN::load(&in.b[c]);
+    const FloatN cnx = FloatN::load(&g.nx[c]), cny = FloatN::load(&g.ny[c]), cnz = FloatN::load(&g.nz[c]);
+    const FloatN cz = FloatN::load(&g.depth[c]);
+    const FloatN lc = lum(cr, cg, cb);
+    const FloatN one(1), zero(0);
+    const FloatN invL = one / (FloatN(p.settings->sigmaLuminance) * sqrt(FloatN::load(&p.variance[c])) + FloatN(EPSILON));
+    const FloatN invZ = one / (FloatN(p.settings->sigmaDepth * p.step) * cz + FloatN(EPSILON));
+
+    const FloatN w0(KERNEL[2] * KERNEL[2]);
+    FloatN sw = w0, sr = w0 * cr, sg = w0 * cg, sb = w0 * cb, sv = w0 * w0 * FloatN::load(&in.var[c]);
+    for (int i = -2; i <= 2; i++) {
+        const int yy = y + i * p.step;
+        if (yy < 0 || yy >= p.height)
+            continue;
+        for (int j = -2; j <= 2; j++) {
+            if (i == 0 && j == 0)
+                continue;
+            const int q = yy * p.width + x + j * p.step;
+            FloatN wn = max(zero, cnx * FloatN::load(&g.nx[q]) + cny * FloatN::load(&g.ny[q]) + cnz * FloatN::load(&g.nz[q]));
+            for (int k = 0; k < p.settings->normalPower; k++)
+                wn = wn * wn;
+            const FloatN qr = FloatN::load(&in.r[q]), qg = FloatN::load(&in.g[q]), qb = FloatN::load(&in.b[q]);
+            const FloatN e = abs(lc - lum(qr, qg, qb)) * invL + abs(cz - FloatN::load(&g.depth[q])) * invZ;
+            const FloatN w = FloatN(KERNEL[i + 2] * KERNEL[j + 2]) * wn * exp(zero - e);
+            sw = sw + w;
+            sr = sr + w * qr;
+            sg = sg + w * qg;
+            sb = sb + w * qb;
+            sv = sv + w * w * FloatN::load(&in.var[q]);
+        }
+    }
+
+    const FloatN inv = one / sw;
+    (sr * inv).store(&p.out->r[c]);
+    (sg * inv).store(&p.out->g[c]);
+    (sb * inv).store(&p.out->b[c]);
+    (sv * inv * inv).store(&p.out->var[c]);
+}
+#endif
+
+void filter_row(const Pass &p, int y) {
+    int x = 0;
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+    // packets where no tap leaves the row, scalar pixels at both ends
+    const int first = std::min(2 * p.step, p.width);
+    for (; x < first; x++)
+        filter(p, x, y);
+    for (; x + LANES - 1 + 2 * p.step < p.width; x += LANES)
+        filter_lanes(p, x, y);
+#endif
+    for (; x < p.width; x++)
+        filter(p, x, y);
+}
+
+}
+
+void denoise(const PixelEstimate *pixels, int width, int height, const DenoiseSettings &settings,
+             int threads, Vec3 *out) {
+    const size_t n = size_t(width) * height;
+    Planes a, b;
+    a.resize(n);
+    b.resize(n);
+    Guide guide;
+    guide.nx.resize(n);
+    guide.ny.resize(n);
+    guide.nz.resize(n);
+    guide.depth.resize(n);
+    std::vector<Vec3> albedo(n);
+    std::vector<Float> variance(n);
+
+    rows(height, threads, [&](int y) {
+        for (size_t i = size_t(y) * width; i < size_t(y + 1) * width; i++) {
+            const Features f = pixels[i].meanFeatures();
+            albedo[i] = component_max(f.albedo, Vec3(ALBEDO_MIN));
+            const Vec3 L = pixels[i].mean() / albedo[i];
+            const Float l = luminance(albedo[i]);
+            a.r[i] = L.r;
+            a.g[i] = L.g;
+            a.b[i] = L.b;
+            a.var[i] = std::min(pixels[i].variance() / (l * l), VARIANCE_MAX);
+            guide.nx[i] = f.normal.x;
+            guide.ny[i] = f.normal.y;
+            guide.nz[i] = f.normal.z;
+            guide.depth[i] = f.depth;
+        }
+    });
+
+    Planes *in = &a, *result = &b;
+    for (int it = 0; it < settings.iterations; it++) {
+        rows(height, threads, [&](int y) { blur_variance(*in, variance.data(), width, height, y); });
+        const Pass pass{ in, result, variance.data(), &guide, width, height, 1 << it, &settings };
+        rows(height, threads, [&](int y) { filter_row(pass, y); });
+        std::swap(in, result);
+    }
+
+    rows(height, threads, [&](int y) {
+        for (size_t i = size_t(y) * width; i < size_t(y + 1) * width; i++)
+            out[i] = Vec3(in->r[i], in->g[i], in->b[i]) * albedo[i];
+    });
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "Adaptive.hpp"
+#include <vector>
+
+/*
+    Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the
+    variance guided luminance weights of SVGF (Schied et al. 2017), run on the
+    linear image before tone mapping. The colour is divided by the first hit
+    albedo, so only the lighting is blurred, and every pass widens a 5x5 B3
+    spline kernel by a factor of two. Neighbours only count as much as their
+    normal, depth and luminance agree with the pixel's, the luminance by the
+    standard deviations tracked in the PixelEstimates.
+*/
+struct DenoiseSettings {
+    int iterations{ 5 };
+    Float sigmaLuminance{ 2 };  // in standard deviations of the filtered variance
+    Float sigmaDepth{ 0.02 };   // relative depth difference per pixel of step
+    int normalPower{ 5 };       // normal weight is dot(n, n')^(2^normalPower)
+};
+
+// filtered mean of every pixel of a width x height image into out, rows split over threads
+void denoise(const PixelEstimate *pixels, int width, int height, const DenoiseSettings &settings,
+             int threads, Vec3 *out);
@@ -0,0 +1,309 @@
+#include "Distributed.hpp"
+#include "Socket.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <poll.h>
+#include <sys/wait.h>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x52544450; // "RTDP"
+constexpr uint32_t VERSION = 1;
+
+/*
+    Every message is a Header followed by size bytes of payload.
+    HELLO (worker): Hello
+    TILE (coordinator) and RESULT (worker): TileMessage and w*h PixelEstimates
+    DONE (coordinator): no more tiles, the worker exits
+*/
+enum Type : uint32_t { HELLO, TILE, RESULT, DONE };
+
+struct Hello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t settings;
+    uint32_t threads;
+    uint32_t estimateSize; // sizeof(PixelEstimate), both sides copy them as they are in memory
+};
+
+struct TileMessage {
+    uint32_t id; // index into the coordinator's tasks
+    int32_t x, y, w, h;
+};
+
+// sends a tile with the estimates of its pixels in accum
+bool send_tile(int fd, Type type, uint32_t id, const Task &task, const PixelEstimate *accum, int width, std::vector<PixelEstimate> &scratch) {
+    const TileMessage tile{ id, task.x, task.y, task.w, task.h };
+    scratch.resize(size_t(task.w) * task.h);
+    for (int i = 0; i < task.h; i++)
+        memcpy(&scratch[size_t(i) * task.w], &accum[size_t(task.y + i) * width + task.x], task.w * sizeof(PixelEstimate));
+    return send_message(fd, type, &tile, sizeof(tile), scratch.data(), scratch.size() * sizeof(PixelEstimate));
+}
+
+// a TILE or RESULT message of size bytes carries the estimates of a non-empty tile
+inline bool tile_size(const TileMessage &tile, uint32_t size) {
+    return tile.w > 0 && tile.h > 0 && size - sizeof(tile) == size_t(tile.w) * tile.h * sizeof(PixelEstimate);
+}
+
+// reads the rest of a TILE or RESULT message, false if it is malformed
+bool recv_tile(int fd, const Header &header, TileMessage &tile, std::vector<PixelEstimate> &estimates) {
+    if (header.size < sizeof(tile) || !recv_all(fd, &tile, sizeof(tile)) || !tile_size(tile, header.size))
+        return false;
+    estimates.resize(size_t(tile.w) * tile.h);
+    return recv_all(fd, estimates.data(), estimates.size() * sizeof(PixelEstimate));
+}
+
+// the same from the payload of a buffered message
+bool read_tile(const Header &header, const char *payload, TileMessage &tile, std::vector<PixelEstimate> &estimates) {
+    if (header.size < sizeof(tile))
+        return false;
+    memcpy(&tile, payload, sizeof(tile));
+    if (!tile_size(tile, header.size))
+        return false;
+    estimates.resize(size_t(tile.w) * tile.h);
+    memcpy(estimates.data(), payload + sizeof(tile), estimates.size() * sizeof(PixelEstimate));
+    return true;
+}
+
+}
+
+bool coordinate(const std::string &address, uint64_t settings, const std::vector<Task> &tasks,
+                const PixelEstimate *accum, int width,
+                const std::function<void(const Task&, const PixelEstimate*)> &commit,
+                const std::atomic<bool> &stop, const std::vector<pid_t> &children) {
+    const int server = open_socket(address, true);
+    if (server < 0) {
+        std::cerr << address << ": can't listen\n";
+        return false;
+    }
+
+    struct Worker {
+        int fd;
+        uint32_t slots; // tiles kept in flight, enough to keep all its threads busy
+        bool ready;     // said hello
+        std::vector<uint32_t> tiles;
+        MessageBuffer received;
+    };
+    // the largest message is the RESULT of the largest tile
+    size_t largest = sizeof(Hello);
+    for (const Task &task : tasks)
+        largest = std::max(largest, sizeof(TileMessage) + size_t(task.w) * task.h * sizeof(PixelEstimate));
+    std::vector<Worker> workers;
+    std::deque<uint32_t> pending;
+    for (uint32_t i = 0; i < tasks.size(); i++)
+        pending.push_back(i);
+    std::vector<bool> done(tasks.size(), false);
+    size_t remaining = tasks.size();
+    size_t alive = children.size();
+
+    std::vector<PixelEstimate> scratch;
+    TileMessage tile;
+
+    // hands out pending tiles until every worker has its slots filled
+    auto assign = [&](Worker &w) {
+        while (w.tiles.size() < w.slots && !pending.empty()) {
+            const uint32_t id = pending.front();
+            if (!send_tile(w.fd, TILE, id, tasks[id], accum, width, scratch))
+                return false;
+            pending.pop_front();
+            w.tiles.push_back(id);
+        }
+        return true;
+    };
+
+    auto drop = [&](size_t i) {
+        Worker &w = workers[i];
+        if (w.ready)
+            std::cerr << "worker " << w.fd << ": lost, handing out its " << w.tiles.size() << " tiles again\n";
+        pending.insert(pending.begin(), w.tiles.begin(), w.tiles.end());
+        close(w.fd);
+        workers.erase(workers.begin() + i);
+    };
+
+    while (remaining > 0 && !stop) {
+        std::vector<pollfd> fds{ { server, POLLIN, 0 } };
+        for (const Worker &w : workers)
+            fds.push_back({ w.fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), 500) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(server, nullptr, nullptr);
+            if (fd >= 0)
+                workers.push_back({ fd, 0, false, {}, MessageBuffer(largest) });
+        }
+
+        for (size_t i = fds.size() - 1; i > 0; i--) {
+            if (!fds[i].revents)
+                continue;
+            // a worker that stops in the middle of a message just keeps its partial one
+            Worker &w = workers[i - 1];
+            const bool open = w.received.receive(w.fd);
+            bool ok = true;
+            Header header;
+            const char *payload;
+            while (ok && w.received.next(header, payload)) {
+                if (header.type == HELLO && !w.ready) {
+                    Hello hello;
+                    ok = header.size == sizeof(hello);
+                    if (ok) {
+                        memcpy(&hello, payload, sizeof(hello));
+                        ok = hello.magic == MAGIC && hello.version == VERSION && hello.estimateSize == sizeof(PixelEstimate);
+                    }
+                    if (ok && hello.settings != settings) {
+                        std::cerr << "worker " << w.fd << ": renders a different scene or settings, turned away\n";
+                        ok = false;
+                    }
+                    if (ok) {
+                        w.ready = true;
+                        w.slots = 2 * std::max(1u, hello.threads);
+                        std::cout << "worker " << w.fd << ": connected with " << hello.threads << " threads\n";
+                    }
+                }
+                else if (header.type == RESULT && w.ready) {
+                    ok = read_tile(header, payload, tile, scratch);
+                    const auto it = ok ? std::find(w.tiles.begin(), w.tiles.end(), tile.id) : w.tiles.end();
+                    if (it != w.tiles.end()) {
+                        const Task &task = tasks[tile.id];
+                        ok = tile.x == task.x && tile.y == task.y && tile.w == task.w && tile.h == task.h;
+                    }
+                    else
+                        ok = false;
+                    if (ok) {
+                        w.tiles.erase(it);
+                        if (!done[tile.id]) {
+                            done[tile.id] = true;
+                            remaining--;
+                            commit(tasks[tile.id], scratch.data());
+                        }
+                    }
+                }
+                else
+                    ok = false;
+                if (ok)
+                    w.received.pop();
+            }
+            ok &= open;
+
+            if (!ok)
+                drop(i - 1);
+        }
+
+        for (size_t i = workers.size(); i-- > 0;) {
+            if (workers[i].ready && !assign(workers[i]))
+                drop(i);
+        }
+
+        // nobody left who could ever finish the frame
+        while (alive > 0 && waitpid(-1, nullptr, WNOHANG) > 0)
+            alive--;
+        if (!children.empty() && alive == 0 && workers.empty() && remaining > 0) {
+            std::cerr << "all workers exited, " << remaining << " tiles left\n";
+            break;
+        }
+    }
+
+    for (Worker &w : workers) {
+        send_message(w.fd, DONE, nullptr, 0);
+        close(w.fd);
+    }
+    close_listener(server, address);
+    return remaining == 0;
+}
+
+bool work(const std::string &address, uint64_t settings, int threads, PixelEstimate *accum, int width, int height,
+          const std::function<void(Task&, int)> &render) {
+    // the coordinator may still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd < 0; attempt++) {
+        fd = open_socket(address, false);
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) {
+        std::cerr << address << ": can't connect\n";
+        return false;
+    }
+
+    const Hello hello{ MAGIC, VERSION, settings, uint32_t(threads), sizeof(PixelEstimate) };
+    if (!send_message(fd, HELLO, &hello, sizeof(hello))) {
+        std::cerr << address << ": connection lost\n";
+        close(fd);
+        return false;
+    }
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::pair<uint32_t, Task>> queue;
+    bool finished = false;
+    std::mutex sendLock;
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::vector<PixelEstimate> scratch;
+            while (true) {
+                std::unique_lock<std::mutex> l(lock);
+                wake.wait(l, [&]() { return finished || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                auto [id, task] = queue.front();
+                queue.pop_front();
+                l.unlock();
+
+                render(task, t);
+
+                // a failed send shows up as a closed connection on the receiving side
+                std::lock_guard<std::mutex> s(sendLock);
+                send_tile(fd, RESULT, id, task, accum, width, scratch);
+            }
+        });
+    }
+
+    // receives tiles until the coordinator says it is done or goes away
+    std::vector<PixelEstimate> estimates;
+    bool done = false;
+    while (true) {
+        Header header;
+        if (!recv_all(fd, &header, sizeof(header)))
+            break;
+        if (header.type == DONE) {
+            done = true;
+            break;
+        }
+        TileMessage tile;
+        if (header.type != TILE || !recv_tile(fd, header, tile, estimates))
+            break;
+        if (tile.x < 0 || tile.y < 0 || tile.w > width - tile.x || tile.h > height - tile.y) {
+            std::cerr << address << ": tile outside the frame\n";
+            break;
+        }
+        for (int i = 0; i < tile.h; i++)
+            memcpy(&accum[size_t(tile.y + i) * width + tile.x], &estimates[size_t(i) * tile.w], tile.w * sizeof(PixelEstimate));
+
+        std::lock_guard<std::mutex> l(lock);
+        queue.emplace_back(tile.id, Task(tile.x, tile.y, tile.w, tile.h, nullptr));
+        wake.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        finished = true;
+        // the coordinator is gone or done, tiles still waiting have no one to go to
+        queue.clear();
+    }
+    wake.notify_all();
+    shutdown(fd, SHUT_RDWR);
+    for (std::thread &t : pool)
+        t.join();
+    close(fd);
+
+    if (!done)
+        std::cerr << address << ": connection lost\n";
+    return done;
+}
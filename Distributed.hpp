@@ -0,0 +1,44 @@
+#pragma once
+#include "JobList.hpp"
+#include "Adaptive.hpp"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+/*
+    Rendering one frame with several processes. A coordinator hands out tiles to
+    worker processes over a socket and collects the returned pixels, workers
+    render the tiles they are given with all their threads.
+    Addresses of the form host:port are TCP, anything else is a Unix domain
+    socket path.
+    A tile goes out with the current PixelEstimates of its pixels (not empty when
+    resuming a checkpoint) and comes back with the finished ones. Workers have to
+    render the same scene with the same settings, both sides pass a hash of them
+    and the coordinator turns away workers that don't match.
+*/
+
+/*
+    Serves the tasks to workers connecting to address until every tile is back.
+    accum (width pixels per row) holds the starting estimates of each tile,
+    commit(task, estimates) is called on the calling thread for every tile that
+    comes back. The tiles of a worker that disconnects are handed out again.
+    Gives up if stop is set or every process in children has exited while no
+    worker is connected. Prints the reason and returns false if it didn't finish.
+*/
+bool coordinate(const std::string &address, uint64_t settings, const std::vector<Task> &tasks,
+                const PixelEstimate *accum, int width,
+                const std::function<void(const Task&, const PixelEstimate*)> &commit,
+                const std::atomic<bool> &stop, const std::vector<pid_t> &children);
+
+/*
+    Connects to a coordinator and renders the tiles it sends on `threads` threads
+    until it has no more. A received tile's estimates are put into accum (width
+    by height pixels), render(task, thread) has to continue them in place.
+    Prints the reason and returns false if the connection fails or is rejected,
+    or a tile doesn't fit into accum.
+*/
+bool work(const std::string &address, uint64_t settings, int threads, PixelEstimate *accum, int width, int height,
+          const std::function<void(Task&, int)> &render);
@@ -0,0 +1,209 @@
+#include "Guiding.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// largest Float below 1, keeps rescaled samples inside their quadrant
+constexpr Float ONE_MINUS_EPSILON = 0x1.fffffep-1;
+
+// inverse of random_unit_vector
+Vec2 square(const Vec3 &d) {
+    Float v = std::atan2(d.x, d.y) * INV_TWO_PI;
+    if (v < 0)
+        v += 1;
+    return Vec2(std::clamp((1 - d.z) * Float(0.5), Float(0), ONE_MINUS_EPSILON), std::min(v, ONE_MINUS_EPSILON));
+}
+
+// quadrant of the unit square p is in, p rescaled to the quadrant
+inline int quadrant(Vec2 &p) {
+    const int x = p.u >= Float(0.5);
+    const int y = p.v >= Float(0.5);
+    p.u = std::min(2 * p.u - x, ONE_MINUS_EPSILON);
+    p.v = std::min(2 * p.v - y, ONE_MINUS_EPSILON);
+    return x | (y << 1);
+}
+
+// picks the first half with probability a / (a + b), s rescaled to the half
+inline int pick(Float a, Float b, Float &s) {
+    const Float p = a + b > 0 ? a / (a + b) : Float(0.5);
+    if (s < p) {
+        s = std::min(s / p, ONE_MINUS_EPSILON);
+        return 0;
+    }
+    s = std::min((s - p) / (1 - p), ONE_MINUS_EPSILON);
+    return 1;
+}
+
+}
+
+DTree::DTree() : m_nodes(1) {}
+
+Vec3 DTree::sample(Vec2 s) const {
+    Vec2 origin(0, 0);
+    Float size = 1;
+    uint32_t n = 0;
+    while (true) {
+        const Node &node = m_nodes[n];
+        Float sum[4];
+        for (int q = 0; q < 4; q++)
+            sum[q] = node.sum[q].load(std::memory_order_relaxed);
+        // the column first, then the quadrant in it
+        const int x = pick(sum[0] + sum[2], sum[1] + sum[3], s.u);
+        const int y = pick(sum[x], sum[x + 2], s.v);
+        const int q = x | (y << 1);
+        size *= Float(0.5);
+        origin.u += x * size;
+        origin.v += y * size;
+        if (!node.child[q])
+            break;
+        n = node.child[q];
+    }
+    return random_unit_vector(Vec2(origin.u + s.u * size, origin.v + s.v * size));
+}
+
+Float DTree::pdf(const Vec3 &direction) const {
+    if (m_energy <= 0)
+        return 0;
+    Vec2 p = square(direction);
+    Float density = 1;
+    uint32_t n = 0;
+    while (true) {
+        const Node &node = m_nodes[n];
+        const Float total = node.total();
+        if (total <= 0)
+            return 0;
+        const int q = quadrant(p);
+        density *= 4 * node.sum[q].load(std::memory_order_relaxed) / total;
+        if (!node.child[q])
+            break;
+        n = node.child[q];
+    }
+    // the square maps to the sphere with constant density
+    return density * Float(0.25) * INV_PI;
+}
+
+void DTree::record(const Vec3 &direction, Float value) {
+    Vec2 p = square(direction);
+    uint32_t n = 0;
+    while (true) {
+        Node &node = m_nodes[n];
+        const int q = quadrant(p);
+        if (!node.child[q]) {
+            node.sum[q].fetch_add(value, std::memory_order_relaxed);
+            return;
+        }
+        n = node.child[q];
+    }
+}
+
+void DTree::build() {
+    for (size_t i = m_nodes.size(); i-- > 0;) {
+        Node &node = m_nodes[i];
+        for (int q = 0; q < 4; q++) {
+            if (node.child[q])
+                node.sum[q].store(m_nodes[node.child[q]].total(), std::memory_order_relaxed);
+        }
+    }
+    m_energy = m_nodes[0].total();
+}
+
+DTree DTree::refined(Float threshold) const {
+    DTree tree;
+    if (m_energy <= 0)
+        return tree;
+
+    // a node of this tree, or a leaf quadrant of it whose energy is spread evenly over the subtree
+    constexpr uint32_t QUADRANT = UINT32_MAX;
+    struct Item {
+        uint32_t from; // node here or QUADRANT
+        uint32_t to;   // node in tree
+        Float energy;  // of a QUADRANT
+        int depth;
+    };
+    std::vector<Item> stack{ { 0, 0, 0, 1 } };
+    const Float limit = threshold * m_energy;
+    while (!stack.empty()) {
+        const Item item = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; q++) {
+            const Node *from = item.from != QUADRANT ? &m_nodes[item.from] : nullptr;
+            const Float energy = from ? from->sum[q].load(std::memory_order_relaxed) : item.energy * Float(0.25);
+            if (energy <= limit || item.depth >= MAX_DEPTH)
+                continue;
+            const uint32_t child = tree.m_nodes.size();
+            tree.m_nodes.emplace_back();
+            tree.m_nodes[item.to].child[q] = child;
+            stack.push_back({ from && from->child[q] ? from->child[q] : QUADRANT, child, energy, item.depth + 1 });
+        }
+    }
+    return tree;
+}
+
+Guide::Guide(const AABB &bounds) : m_nodes{ { { 0, 0 }, 0, 0 } }, m_leaves(1) {
+    if (bounds.extent().max() >= 0 && !bounds.unbounded()) {
+        // a cube, so that the split planes cycling through the axes make cells of the same shape
+        const Float half = bounds.extent().max() * Float(0.5) * Float(1.001) + Float(1e-3);
+        m_bounds = AABB(bounds.center() - Vec3(half), bounds.center() + Vec3(half));
+    }
+    else
+        m_bounds = AABB(Vec3(-1), Vec3(1));
+}
+
+uint32_t Guide::leaf(const Vec3 &p) const {
+    Float lo[3] = { m_bounds.min.x, m_bounds.min.y, m_bounds.min.z };
+    Float hi[3] = { m_bounds.max.x, m_bounds.max.y, m_bounds.max.z };
+    uint32_t n = 0;
+    while (m_nodes[n].child[0]) {
+        const Node &node = m_nodes[n];
+        const Float middle = (lo[node.axis] + hi[node.axis]) * Float(0.5);
+        const int side = p[node.axis] >= middle;
+        (side ? lo : hi)[node.axis] = middle;
+        n = node.child[side];
+    }
+    return m_nodes[n].leaf;
+}
+
+void Guide::refine(uint32_t pass) {
+    for (Leaf &l : m_leaves) {
+        l.building.build();
+        l.sampling = l.building;
+        l.building = l.sampling.refined(DIRECTIONAL_THRESHOLD);
+    }
+
+    const Float threshold = SPLIT_RECORDS * std::sqrt(Float(1u << pass));
+    const size_t nodes = m_nodes.size();
+    for (size_t n = 0; n < nodes; n++) {
+        if (!m_nodes[n].child[0])
+            split(n, m_leaves[m_nodes[n].leaf].records.load(std::memory_order_relaxed), threshold);
+    }
+    for (Leaf &l : m_leaves)
+        l.records.store(0, std::memory_order_relaxed);
+}
+
+// halves the leaf node until each part got at most threshold of its records
+void Guide::split(uint32_t node, uint32_t records, Float threshold) {
+    if (records <= threshold)
+        return;
+    const uint32_t leaf = m_nodes[node].leaf;
+    const uint8_t axis = (m_nodes[node].axis + 1) % 3;
+    for (int side = 0; side < 2; side++) {
+        const uint32_t child = m_nodes.size();
+        uint32_t l = leaf;
+        if (side) {
+            l = m_leaves.size();
+            m_leaves.push_back(m_leaves[leaf]);
+        }
+        m_nodes.push_back({ { 0, 0 }, l, axis });
+        m_nodes[node].child[side] = child;
+    }
+    for (int side = 0; side < 2; side++)
+        split(m_nodes[node].child[side], records / 2, threshold);
+}
+
+size_t Guide::directionalNodes() const {
+    size_t n = 0;
+    for (const Leaf &l : m_leaves)
+        n += l.sampling.nodes();
+    return n;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "Vector.hpp"
+#include "AABB.hpp"
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+/*
+    Path guiding with an SD-tree (Mueller et al. 2017, Practical Path Guiding
+    for Efficient Light-Transport Simulation). A binary tree over the scene
+    bounds, split at the middle along x, y and z in turn, holds a DTree in
+    every leaf: a quadtree over the unit square that random_unit_vector maps
+    to the sphere of directions, whose nodes store how much light arrives from
+    their part of the sphere.
+    A guided render starts with training passes. During a pass the paths
+    record the light they found at every vertex into the building trees, with
+    atomic adds into a structure that stays fixed until the pass is over,
+    while sampling from the trees the previous pass built. refine() then
+    turns the building trees into the sampling ones and refines the structure
+    for the next pass: spatial leaves that got many records are split in
+    half, and directional nodes holding more than a small part of the light
+    get four children.
+*/
+class DTree {
+public:
+    DTree();
+
+    // direction picked in proportion to the stored light, s uniform in [0,1)^2
+    Vec3 sample(Vec2 s) const;
+
+    // density of sample() per solid angle
+    Float pdf(const Vec3 &direction) const;
+
+    // adds value to the light arriving from direction, may be called from several threads
+    void record(const Vec3 &direction, Float value);
+
+    // sums the recorded light into the inner nodes, the total is energy()
+    void build();
+    inline Float energy() const { return m_energy; }
+
+    // empty tree with nodes where build() found more than threshold of the energy
+    DTree refined(Float threshold) const;
+
+    inline size_t nodes() const { return m_nodes.size(); }
+
+private:
+    static constexpr int MAX_DEPTH = 20;
+
+    // four quadrants, x is the low bit; a quadrant with child 0 is a leaf
+    struct Node {
+        std::atomic<Float> sum[4];
+        uint32_t child[4];
+
+        Node() : sum{ 0, 0, 0, 0 }, child{ 0, 0, 0, 0 } {}
+        Node(const Node &n) { *this = n; }
+        Node &operator=(const Node &n) {
+            for (int q = 0; q < 4; q++) {
+                sum[q].store(n.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                child[q] = n.child[q];
+            }
+            return *this;
+        }
+        inline Float total() const {
+            return sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed)
+                 + sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<Node> m_nodes; // children come after their parent
+    Float m_energy{ 0 };
+};
+
+class Guide {
+public:
+    Float alpha{ 0.5 };    // probability of sampling the guide rather than the BSDF
+    bool training{ false }; // paths record what they find
+
+    explicit Guide(const AABB &bounds);
+
+    // the spatial leaf p falls into, points outside the bounds go to the nearest one
+    uint32_t leaf(const Vec3 &p) const;
+
+    // the distribution to sample at a leaf, nullptr while it hasn't seen any light
+    inline const DTree *distribution(uint32_t leaf) const {
+        const DTree &d = m_leaves[leaf].sampling;
+        return d.energy() > 0 ? &d : nullptr;
+    }
+
+    inline void record(uint32_t leaf, const Vec3 &direction, Float value) {
+        Leaf &l = m_leaves[leaf];
+        l.records.fetch_add(1, std::memory_order_relaxed);
+        l.building.record(direction, value);
+    }
+
+    // ends training pass `pass` (counted from 0, of 2^pass samples per pixel), not while paths are traced
+    void refine(uint32_t pass);
+
+    inline size_t leaves() const { return m_leaves.size(); }
+    size_t directionalNodes() const;
+
+private:
+    // records a spatial leaf may collect in a pass of one sample per pixel before it is split
+    static constexpr Float SPLIT_RECORDS = 12000;
+    // part of the energy a directional node needs to be subdivided
+    static constexpr Float DIRECTIONAL_THRESHOLD = 0.01;
+
+    struct Node {
+        uint32_t child[2]; // child[0] == 0: a leaf
+        uint32_t leaf;     // index into m_leaves
+        uint8_t axis;
+    };
+
+    struct Leaf {
+        DTree sampling, building;
+        std::atomic<uint32_t> records{ 0 };
+
+        Leaf() = default;
+        Leaf(const Leaf &l) : sampling(l.sampling), building(l.building) {}
+    };
+
+    AABB m_bounds; // a cube around the scene
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+
+    void split(uint32_t node, uint32_t records, Float threshold);
+};
@@ -1,6 +1,10 @@
 #pragma once
 #include "Vector.hpp"
 #include "Object.hpp"
+#include "Scene.hpp"
+#include "Sampler.hpp"
+#include "Adaptive.hpp"
+#include "Guiding.hpp"
 #include <vector>
 
 constexpr int W = 1920;
@@ -11,40 +15,233 @@ constexpr int BOUNCES = 16;
 static constexpr Vec3 AMBIENT = Vec3(0.9, 0.95, 1.0) * PI * 0.5;
 
 
-Vec3 Li(const std::vector<const Object*> &objects, const Ray& ray, Float Prr = 1, Float eta = 1, uint32_t D=0, const void* const prev = nullptr) {
-    if (D >= BOUNCES)
-        return AMBIENT;
+// fraction of the distance to a light a shadow ray tests, keeps the light itself out
+constexpr Float SHADOW_TMAX = 1 - 1e-4;
 
-    Interaction interaction(&ray);
-    for (const Object* obj : objects) {
-        if (obj != prev)
-            obj->hit(&interaction);
+// power heuristic weight of a sample drawn with density a against a technique with density b
+inline Float mis(Float a, Float b) {
+    // a^2 / (a^2 + b^2) without squaring the huge densities of distant small lights
+    const Float r = b / a;
+    return 1 / (1 + r * r);
+}
+
+/*
+    Samples the continuation of a path at a hit found and updated by the scene,
+    color is the weight of the returned ray and pdf its density for MIS, 0 for
+    mirror directions. B is the concrete BxDF of the hit's material.
+*/
+template <typename B>
+inline Ray scatter(const B &bxdf, const Interaction &interaction, Float Prr, Vec3 &color, Float &pdf, Sampler &sampler) {
+    const Float rnd = sampler.get1D();
+    const Vec2 s = sampler.get2D();
+    const BSDFSample b = bxdf.sample(interaction.ray->direction, interaction.normal, rnd, s);
+    color = bxdf.f() * (b.rho / Prr);
+    pdf = b.pdf;
+    return Ray(interaction.position, b.direction);
+}
+
+inline Ray scatter(const Material &material, const Interaction &interaction, Float Prr, Vec3 &color, Float &pdf, Sampler &sampler) {
+    return material.visit([&](const auto &bxdf) { return scatter(bxdf, interaction, Prr, color, pdf, sampler); });
+}
+
+// density the guided scatter() picks the non-mirror direction O with
+template <typename B>
+inline Float guided_pdf(const B &bxdf, const Vec3 &N, const Vec3 &O, const DTree &guide, Float alpha) {
+    return alpha * bxdf.lobe() * guide.pdf(O) + (1 - alpha) * bxdf.pdf(N, O);
+}
+
+/*
+    scatter() guided by a learned distribution of the incoming light: when the
+    BSDF picks its non-mirror part, the direction comes from guide with
+    probability alpha, and pdf is the density of the mixture.
+*/
+template <typename B>
+inline Ray scatter(const B &bxdf, const Interaction &interaction, const DTree &guide, Float alpha, Float Prr,
+                   Vec3 &color, Float &pdf, Sampler &sampler) {
+    // u comes last, so the BSDF sees the same sampler dimensions as without a guide
+    const Float rnd = sampler.get1D();
+    const Vec2 s = sampler.get2D();
+    const Float u = sampler.get1D();
+    const Vec3 &I = interaction.ray->direction;
+    const BSDFSample b = bxdf.sample(I, interaction.normal, rnd, s);
+    if (b.pdf <= 0) {
+        color = bxdf.f() * (b.rho / Prr);
+        pdf = 0;
+        return Ray(interaction.position, b.direction);
     }
+    const Vec3 O = u < alpha ? guide.sample(s) : b.direction;
+    pdf = guided_pdf(bxdf, interaction.normal, O, guide, alpha);
+    color = pdf > 0 ? bxdf.eval(I, interaction.normal, O) / (pdf * Prr) : Vec3(0);
+    return Ray(interaction.position, O);
+}
+
+inline Ray scatter(const Material &material, const Interaction &interaction, const DTree &guide, Float alpha, Float Prr,
+                   Vec3 &color, Float &pdf, Sampler &sampler) {
+    return material.visit([&](const auto &bxdf) { return scatter(bxdf, interaction, guide, alpha, Prr, color, pdf, sampler); });
+}
+
+/*
+    Next event estimation: the light of one sampled point on a light reaching
+    an updated hit through the non-mirror part of its material, weighted
+    against finding the same light with scatter(), guided by guide if given.
+*/
+inline Vec3 direct(const Scene &scene, const Interaction &interaction, const Material &material, Sampler &sampler,
+                   const DTree *guide = nullptr, Float alpha = 0) {
+    const Float u = sampler.get1D();
+    const Vec2 s = sampler.get2D();
+    return material.visit([&](const auto &bxdf) {
+        if (!bxdf.diffuse())
+            return Vec3(0);
+        const LightSample light = scene.sampleLight(interaction.position, u, s);
+        if (light.pdf <= 0)
+            return Vec3(0);
 
-    if (!interaction.type)
-        return AMBIENT;
+        const Vec3 f = bxdf.eval(interaction.ray->direction, interaction.normal, light.direction);
+        if (f.max() <= 0)
+            return Vec3(0);
 
-    Vec3 f(0);
+        STAT(threadStats.shadowRays++);
+        if (scene.occluded(Ray(interaction.position, light.direction), light.distance * SHADOW_TMAX, interaction.object))
+            return Vec3(0);
+        const Float pdf = guide ? guided_pdf(bxdf, interaction.normal, light.direction, *guide, alpha)
+                                : bxdf.pdf(interaction.normal, light.direction);
+        return f * light.Le * (mis(light.pdf, pdf) / light.pdf);
+    });
+}
 
-    Float rr = UniRand();
-    if (rr < Prr) {
-        interaction.update();
-        const Object * object = interaction.object;
-        const BxDF& material = *interaction.object->material;
-        const Vec3 &normal = interaction.normal;
-        const Vec3 &position = interaction.position;
-        const Float t = interaction.t;
+// emitted light of a hit at distance t, pdf is the density scatter() gave the ray
+inline Vec3 emitted(const Scene &scene, const Ray &ray, const Handle object, Float t, const Material &material, Float pdf) {
+    if (!material.emissive())
+        return Vec3(0);
+    return pdf > 0 ? material.Le * mis(pdf, scene.lightPdf(ray, object, t)) : material.Le;
+}
 
-        const Float inv_Prr = 1 / Prr;
+// features of an updated first hit
+inline Features features(const Interaction &interaction, const Material &material) {
+    return { material.f(), interaction.normal, interaction.t };
+}
 
-        Float rnd = UniRand();
-        Float Fr = fresnel(ray.direction, normal, 1.0, material.eta);
+// the updated first hit of a camera ray, what the G-buffer of a tile keeps to start paths from
+struct PrimaryHit {
+    Ray ray;
+    Handle object; // NONE if the ray escaped
+    Float t;
+    Vec3 uv;
+    Vec3 position;
+    Vec3 normal;
 
-        const Ray r(position, material.reflect(rnd, Fr, ray.direction, normal));
-        const Float rho = material.rho(rnd, Fr, normal, r.direction);
-        const Vec3 color = material.f() * (rho * inv_Prr);
-        f += color * Li(objects, r, Prr*color.max(), 1.0, D+1, object);
+    PrimaryHit(const Scene &scene, const Ray &r) : ray(r) {
+        Interaction interaction(&ray);
+        STAT(threadStats.ray(0));
+        scene.intersect(&interaction);
+        if (interaction.object.type != TYPE::NONE)
+            scene.update(&interaction);
+        object = interaction.object;
+        t = interaction.t;
+        uv = interaction.uv;
+        position = interaction.position;
+        normal = interaction.normal;
     }
 
-    return f;
-}
\ No newline at end of file
+    // interaction.ray has to be this ray
+    inline void restore(Interaction &interaction) const {
+        interaction.object = object;
+        interaction.t = t;
+        interaction.uv = uv;
+        interaction.position = position;
+        interaction.normal = normal;
+    }
+};
+
+/*
+    One path from a camera ray, a loop over its bounces with the throughput
+    beta and the Russian roulette probability Prr carried along, the same
+    estimator and sampler dimensions as Wavefront. first, if given, is filled
+    in with the features of the first hit. With primary the path starts from
+    that cached hit of ray instead of intersecting it. With guide the diffuse
+    bounces sample its distributions, and while it trains the path records the
+    light it found after each of them.
+*/
+inline Vec3 Li(const Scene &scene, Ray ray, Sampler &sampler, Features *first = nullptr, uint32_t bounces = BOUNCES,
+               const PrimaryHit *primary = nullptr, Guide *guide = nullptr) {
+    // a bounce that records the light arriving from direction, throughput is the path's weight after it
+    struct Vertex {
+        uint32_t leaf;
+        Vec3 direction;
+        Float pdf;
+        Vec3 throughput;
+        Vec3 radiance;
+    };
+    Vertex vertices[BOUNCES];
+    uint32_t recorded = 0;
+    const bool training = guide && guide->training;
+
+    Vec3 L(0);
+    Vec3 beta(1);
+    Float Prr = 1;
+    Float pdf = 0;
+    Handle prev;
+    const auto add = [&](const Vec3 &X) {
+        L += beta * X;
+        for (uint32_t i = 0; i < recorded; i++)
+            vertices[i].radiance += vertices[i].throughput * X;
+    };
+    const auto record = [&]() {
+        for (uint32_t i = 0; i < recorded; i++)
+            guide->record(vertices[i].leaf, vertices[i].direction, luminance(vertices[i].radiance) / vertices[i].pdf);
+    };
+    for (uint32_t depth = 0; depth < bounces; depth++) {
+        Interaction interaction(&ray);
+        if (depth == 0 && primary)
+            primary->restore(interaction);
+        else {
+            STAT(threadStats.ray(depth));
+            scene.intersect(&interaction, prev);
+            if (interaction.object.type != TYPE::NONE)
+                scene.update(&interaction);
+        }
+        if (interaction.object.type == TYPE::NONE)
+            break;
+
+        const Material &material = *scene.material(interaction.object);
+        if (first && depth == 0)
+            *first = features(interaction, material);
+        const bool guided = guide && material.diffuse();
+        uint32_t leaf = 0;
+        const DTree *distribution = nullptr;
+        if (guided) {
+            leaf = guide->leaf(interaction.position);
+            distribution = guide->distribution(leaf);
+        }
+        if (material.emissive())
+            add(emitted(scene, ray, interaction.object, interaction.t, material, pdf));
+        if (!scene.lights.empty())
+            add(direct(scene, interaction, material, sampler, distribution, guide ? guide->alpha : 0));
+
+        if (sampler.get1D() >= Prr) {
+            STAT(threadStats.roulette++);
+            if (training)
+                record();
+            return L;
+        }
+        Vec3 color;
+        if (distribution)
+            ray = scatter(material, interaction, *distribution, guide->alpha, Prr, color, pdf, sampler);
+        else
+            ray = scatter(material, interaction, Prr, color, pdf, sampler);
+        beta = beta * color;
+        // guided weights aren't bounded by the albedo, a survival probability above 1 would lose energy
+        Prr = std::min(Float(1), Prr * color.max());
+        prev = interaction.object;
+        if (training) {
+            for (uint32_t i = 0; i < recorded; i++)
+                vertices[i].throughput = vertices[i].throughput * color;
+            if (guided && pdf > 0 && recorded < BOUNCES)
+                vertices[recorded++] = { leaf, ray.direction, pdf, Vec3(1), Vec3(0) };
+        }
+    }
+    add(AMBIENT);
+    if (training)
+        record();
+    return L;
+}
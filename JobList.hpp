@@ -0,0 +1,116 @@
+#pragma once
+#include "Vector.hpp"
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+struct Task {
+    int x, y;
+    int w, h;
+    Vec3* image;
+
+    Task() = default;
+    Task(int x, int y, int w, int h, Vec3* image) : x(x), y(y), w(w), h(h), image(image) {}
+    Task(const Task &t) : x(t.x), y(t.y), w(t.w), h(t.h), image(t.image) {}
+};
+
+// interleaves the bits of x and y, nearby tiles get nearby keys
+constexpr uint64_t morton(uint32_t x, uint32_t y) {
+    uint64_t key = 0;
+    for (int b = 0; b < 32; b++)
+        key |= (uint64_t((x >> b) & 1) << (2*b)) | (uint64_t((y >> b) & 1) << (2*b + 1));
+    return key;
+}
+
+/*
+    Lock-free work-stealing tile scheduler. The tasks are split into one
+    contiguous range per worker. A worker takes tiles from the front of its own
+    range; once that is empty it steals the back half of another worker's range.
+    Each range is a (front, back) pair packed into one 64 bit atomic.
+*/
+struct JobList {
+    std::vector<Task> tasks;
+
+    // tiles of size block covering a W x H image, ordered along a Morton curve
+    void build(int W, int H, int block, Vec3 *image) {
+        tasks.clear();
+        std::vector<uint64_t> keys;
+        for (int i=0; i < H; i += block) {
+            for (int j=0; j < W; j += block) {
+                int w = block, h = block;
+                if (j+w > W)
+                    w = W-j;
+                if (i+h > H)
+                    h = H-i;
+                tasks.emplace_back(j, i, w, h, &image[i*W+j]);
+                keys.push_back(morton(j / block, i / block));
+            }
+        }
+
+        std::vector<uint32_t> order(tasks.size());
+        for (uint32_t i=0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+        std::vector<Task> sorted;
+        sorted.reserve(tasks.size());
+        for (uint32_t i : order)
+            sorted.push_back(tasks[i]);
+        tasks.swap(sorted);
+    }
+
+    // hands out the tasks again, split evenly over the given number of workers
+    void reset(int workers) {
+        m_workers = workers;
+        m_ranges = std::make_unique<Range[]>(workers);
+        const uint64_t n = tasks.size();
+        for (int w=0; w < workers; w++)
+            m_ranges[w].bounds.store(pack(n * w / workers, n * (w+1) / workers));
+        m_taken.store(0);
+    }
+
+    Task* getTask(int worker) {
+        std::atomic<uint64_t> &own = m_ranges[worker].bounds;
+        uint64_t v = own.load(std::memory_order_relaxed);
+        while (front(v) < back(v)) {
+            if (own.compare_exchange_weak(v, pack(front(v) + 1, back(v))))
+                return take(front(v));
+        }
+
+        for (int k=1; k < m_workers; k++) {
+            std::atomic<uint64_t> &victim = m_ranges[(worker + k) % m_workers].bounds;
+            v = victim.load(std::memory_order_relaxed);
+            while (front(v) < back(v)) {
+                const uint64_t mid = front(v) + (back(v) - front(v)) / 2;
+                if (victim.compare_exchange_weak(v, pack(front(v), mid))) {
+                    // only thieves look at our range now and they see it empty
+                    own.store(pack(mid + 1, back(v)));
+                    return take(mid);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t getProgress() const { return m_taken.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Range {
+        std::atomic<uint64_t> bounds{ 0 };
+    };
+
+    std::unique_ptr<Range[]> m_ranges;
+    int m_workers{ 0 };
+    std::atomic<uint64_t> m_taken{ 0 };
+
+    static constexpr uint64_t pack(uint64_t front, uint64_t back) { return (back << 32) | front; }
+    static constexpr uint64_t front(uint64_t v) { return v & 0xFFFFFFFF; }
+    static constexpr uint64_t back(uint64_t v) { return v >> 32; }
+
+    inline Task* take(uint64_t i) {
+        m_taken.fetch_add(1, std::memory_order_relaxed);
+        return &tasks[i];
+    }
+};
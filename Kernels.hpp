@@ -0,0 +1,173 @@
+#pragma once
+#include "Simd.hpp"
+#include "Object.hpp"
+#include <vector>
+#include <cstdint>
+
+/*
+    Structure-of-arrays copies of the primitives and kernels testing one ray
+    against LANES of them at once. Every kernel returns the index of the closest
+    accepted primitive in [begin, begin + count) and shrinks tmax, or -1.
+    The acceptance tests mirror the scalar hit() functions in Object.cpp.
+    Arrays are padded by LANES entries so the last load never reads past the end.
+*/
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+
+static_assert(sizeof(Float) == 4, "SIMD kernels need single precision Float");
+
+struct SphereSoA {
+    std::vector<Float> x, y, z, r2;
+
+    void build(const std::vector<Sphere> &spheres) {
+        const size_t n = spheres.size() + LANES;
+        x.assign(n, 0); y.assign(n, 0); z.assign(n, 0); r2.assign(n, 0);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            x[i] = spheres[i].position.x;
+            y[i] = spheres[i].position.y;
+            z[i] = spheres[i].position.z;
+            r2[i] = spheres[i].radius * spheres[i].radius;
+        }
+    }
+};
+
+struct PlaneSoA {
+    std::vector<Float> x, y, z, d;
+
+    void build(const std::vector<Plane> &planes) {
+        const size_t n = planes.size() + LANES;
+        x.assign(n, 0); y.assign(n, 0); z.assign(n, 0); d.assign(n, 0);
+        for (size_t i = 0; i < planes.size(); i++) {
+            x[i] = planes[i].position.x;
+            y[i] = planes[i].position.y;
+            z[i] = planes[i].position.z;
+            d[i] = planes[i].hesse_const;
+        }
+    }
+};
+
+struct TriangleSoA {
+    std::vector<Float> px, py, pz;
+    std::vector<Float> ux, uy, uz;
+    std::vector<Float> vx, vy, vz;
+    std::vector<Float> nx, ny, nz;
+
+    void build(const std::vector<Triangle> &triangles) {
+        const size_t n = triangles.size() + LANES;
+        for (std::vector<Float> *a : { &px, &py, &pz, &ux, &uy, &uz, &vx, &vy, &vz, &nx, &ny, &nz })
+            a->assign(n, 0);
+        for (size_t i = 0; i < triangles.size(); i++) {
+            const Triangle &tri = triangles[i];
+            px[i] = tri.position.x; py[i] = tri.position.y; pz[i] = tri.position.z;
+            ux[i] = tri.u.x; uy[i] = tri.u.y; uz[i] = tri.u.z;
+            vx[i] = tri.v.x; vy[i] = tri.v.y; vz[i] = tri.v.z;
+            nx[i] = tri.true_normal.x; ny[i] = tri.true_normal.y; nz[i] = tri.true_normal.z;
+        }
+    }
+};
+
+// lanes past the range and the skipped primitive are never accepted
+inline FloatN active_lanes(uint32_t i, uint32_t end, int64_t skip) {
+    const FloatN lane = FloatN::index();
+    const FloatN inside = lane < FloatN(Float(end - i));
+    return andnot(lane == FloatN(Float(skip - int64_t(i))), inside);
+}
+
+// picks the closest accepted lane, returns its index within the packet or -1
+inline int closest_lane(const FloatN &valid, const FloatN &t, Float &tmax) {
+    if (!valid.mask())
+        return -1;
+    const FloatN tv = select(valid, t, FloatN(INF));
+    const Float m = hmin(tv);
+    tmax = m;
+    return __builtin_ctz((tv == FloatN(m)).mask() & valid.mask());
+}
+
+inline int hit_spheres(const SphereSoA &s, uint32_t begin, uint32_t count, const Ray &ray, Float &tmax, int64_t skip) {
+    const FloatN ox(ray.position.x), oy(ray.position.y), oz(ray.position.z);
+    const FloatN dx(ray.direction.x), dy(ray.direction.y), dz(ray.direction.z);
+    const FloatN zero(0);
+    const uint32_t end = begin + count;
+
+    int best = -1;
+    for (uint32_t i = begin; i < end; i += LANES) {
+        const FloatN cx = FloatN::load(&s.x[i]) - ox;
+        const FloatN cy = FloatN::load(&s.y[i]) - oy;
+        const FloatN cz = FloatN::load(&s.z[i]) - oz;
+
+        const FloatN rDd = cx*dx + cy*dy + cz*dz;
+        const FloatN disc = rDd*rDd + FloatN::load(&s.r2[i]) - (cx*cx + cy*cy + cz*cz);
+        const FloatN t = rDd - sqrt(select(disc > zero, disc, zero));
+
+        const FloatN valid = active_lanes(i, end, skip) & (rDd >= zero) & (disc >= zero) & (t <= FloatN(tmax));
+        const int lane = closest_lane(valid, t, tmax);
+        if (lane >= 0)
+            best = i + lane;
+    }
+    return best;
+}
+
+inline int hit_planes(const PlaneSoA &p, uint32_t begin, uint32_t count, const Ray &ray, Float &tmax, int64_t skip) {
+    const FloatN ox(ray.position.x), oy(ray.position.y), oz(ray.position.z);
+    const FloatN dx(ray.direction.x), dy(ray.direction.y), dz(ray.direction.z);
+    const FloatN zero(0);
+    const uint32_t end = begin + count;
+
+    int best = -1;
+    for (uint32_t i = begin; i < end; i += LANES) {
+        const FloatN nx = FloatN::load(&p.x[i]);
+        const FloatN ny = FloatN::load(&p.y[i]);
+        const FloatN nz = FloatN::load(&p.z[i]);
+
+        const FloatN den = nx*dx + ny*dy + nz*dz;
+        const FloatN num = FloatN::load(&p.d[i]) - (nx*ox + ny*oy + nz*oz);
+
+        const FloatN valid = active_lanes(i, end, skip) & (den < zero) & (num > FloatN(tmax) * den);
+        const int lane = closest_lane(valid, num / den, tmax);
+        if (lane >= 0)
+            best = i + lane;
+    }
+    return best;
+}
+
+inline int hit_triangles(const TriangleSoA &s, uint32_t begin, uint32_t count, const Ray &ray, Float &tmax, Vec3 &uv, int64_t skip) {
+    const FloatN ox(ray.position.x), oy(ray.position.y), oz(ray.position.z);
+    const FloatN dx(ray.direction.x), dy(ray.direction.y), dz(ray.direction.z);
+    const FloatN zero(0);
+    const uint32_t end = begin + count;
+
+    int best = -1;
+    for (uint32_t i = begin; i < end; i += LANES) {
+        const FloatN nx = FloatN::load(&s.nx[i]);
+        const FloatN ny = FloatN::load(&s.ny[i]);
+        const FloatN nz = FloatN::load(&s.nz[i]);
+        const FloatN det = dx*nx + dy*ny + dz*nz;
+
+        const FloatN ex = ox - FloatN::load(&s.px[i]);
+        const FloatN ey = oy - FloatN::load(&s.py[i]);
+        const FloatN ez = oz - FloatN::load(&s.pz[i]);
+        const FloatN tt = nx*ex + ny*ey + nz*ez;
+
+        // delta x direction
+        const FloatN cx = ey*dz - ez*dy;
+        const FloatN cy = ez*dx - ex*dz;
+        const FloatN cz = ex*dy - ey*dx;
+        const FloatN a = zero - (cx*FloatN::load(&s.vx[i]) + cy*FloatN::load(&s.vy[i]) + cz*FloatN::load(&s.vz[i]));
+        const FloatN b = cx*FloatN::load(&s.ux[i]) + cy*FloatN::load(&s.uy[i]) + cz*FloatN::load(&s.uz[i]);
+
+        const FloatN valid = active_lanes(i, end, skip) & (det < zero) & (tt > zero) & (zero - tt > FloatN(tmax) * det)
+            & (a <= zero) & (b <= zero) & (a >= det) & (b >= det) & (a + b >= det);
+
+        const FloatN inv_det = FloatN(1) / det;
+        const int lane = closest_lane(valid, (zero - tt) * inv_det, tmax);
+        if (lane >= 0) {
+            alignas(32) Float u[LANES], v[LANES];
+            (a * inv_det).store(u);
+            (b * inv_det).store(v);
+            uv = Vec3(u[lane], v[lane], 0);
+            best = i + lane;
+        }
+    }
+    return best;
+}
+
+#endif
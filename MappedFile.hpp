@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read only mapping of a whole file
+struct MappedFile {
+    const char *data{ nullptr };
+    size_t size{ 0 };
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data)
+            munmap(const_cast<char*>(data), size);
+    }
+
+    bool open(const std::string &path, int advice = MADV_SEQUENTIAL) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, st.st_size, advice);
+        data = static_cast<const char*>(p);
+        size = st.st_size;
+        return true;
+    }
+};
+
+/*
+    64 bit hash of a byte range, chained through h. Only used to detect changed
+    inputs, it is fast rather than strong.
+*/
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t h = 0xcbf29ce484222325ull) {
+    constexpr uint64_t PRIME = 0x100000001b3ull;
+    const char *p = static_cast<const char*>(data);
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * PRIME;
+        h ^= h >> 29;
+    }
+    for (; size > 0; size--, p++)
+        h = (h ^ uint8_t(*p)) * PRIME;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    return h ^ (h >> 32);
+}
+
+// chains the contents of a file into h, false if it can't be read
+inline bool hash_file(const std::string &path, uint64_t &h) {
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    h = hash_bytes(file.data, file.size, h);
+    return true;
+}
@@ -1,20 +1,81 @@
 #pragma once
 #include "Vector.hpp"
+#include <optional>
+#include <variant>
+#include <cstdint>
 
+// flat description of a material, how the scene cache stores it
+struct MaterialRecord {
+    enum Kind : uint32_t { LAMBERTIAN, SPECULAR, DIELECTRIC, EMISSIVE };
+
+    Kind kind;
+    Vec3 R;  // Emissive: emitted radiance
+    Vec3 T;
+    Float eta;
+    Float param; // Specular: rho, DiElectric: roughness
+
+    bool operator==(const MaterialRecord &) const = default;
+};
+
+inline Float fresnel(const Vec3 &I, const Vec3 &N, Float etaI, Float etaT) {
+    Float cosThetaI = -I.dot(N);
+    if (cosThetaI < 0) {
+        std::swap(etaI, etaT);
+        cosThetaI = -cosThetaI;
+    }
+    Float sinThetaI = sqrt(std::max(Float(0), 1-cosThetaI*cosThetaI));
+    Float sinThetaT = etaI / etaT * sinThetaI;
+    if (sinThetaT > 1)
+        sinThetaT = 1;
+
+    Float cosThetaT = sqrt(1-sinThetaT*sinThetaT);
+
+    Float TI = etaT * cosThetaI;
+    Float TT = etaT * cosThetaT;
+    Float IT = etaI * cosThetaT;
+    Float II = etaI * cosThetaI;
+
+    Float Rparl = (TI - IT) / (TI + IT);
+    Float Rperp = (II - TT) / (II + TT);
+
+    return 0.5 * (Rparl * Rparl + Rperp * Rperp);
+}
+
+// a direction picked by sample(), f() * rho is its weight, pdf is 0 for mirror directions
+struct BSDFSample {
+    Vec3 direction;
+    Float rho;
+    Float pdf;
+};
+
+/*
+    The data every BxDF has. The BxDFs are not virtual, a Material holds one of
+    them and dispatches on its type with visit(), so each one only does the work
+    it needs, the Lambertian doesn't compute Fresnel terms.
+    They all provide:
+    - sample(I, N, rnd, s): picks a direction with a uniform rnd and s
+    - eval(I, N, O), pdf(N, O): the same estimator for a given direction,
+      restricted to the part light sampling can reach: eval() is the BSDF times
+      the cosine, pdf() the density sample() picks the direction with (over all
+      rnd), both 0 for mirror directions, so eval / pdf = f * rho
+    - diffuse(): false if eval() is 0 everywhere
+    - lobe(): the probability sample() picks the non-mirror part, what pdf()
+      integrates to over the hemisphere
+    - record()
+*/
 class BxDF {
 protected:
     Vec3 R;
     Vec3 T;
 
-public:
     constexpr BxDF(const Vec3& reflectance, const Vec3& transmission, Float eta)
         : R(reflectance)
         , T(transmission)
         , eta(eta) {}
 
-    virtual inline Vec3 f() const = 0;
-    virtual inline Float rho(Float rnd, Float Fr, const Vec3& N, const Vec3& O) const = 0;
-    virtual inline Vec3 reflect(Float rnd, Float Fr, const Vec3& I, const Vec3& N) const = 0;
+public:
+    inline Vec3 f() const { return R; }
+    constexpr Vec3 emission() const { return Vec3(0); }
 
     Float eta;
 };
@@ -22,77 +83,113 @@ public:
 class Lambertion : public BxDF {
 public:
     constexpr Lambertion(const Vec3& R, const Vec3& T, Float eta = 1) : BxDF(R, T, eta) {}
-    inline Vec3 f() const { return R; }
-    inline Float rho(Float rnd, Float Fr, const Vec3& N, const Vec3& O) const {
-        return INV_PI * N.dot(O);
+    // cosine weighted, the cosine of eval() cancels against the density
+    inline BSDFSample sample(const Vec3& I, const Vec3& N, Float rnd, const Vec2& s) const {
+        const Vec3 O = cosine_hemi_vector(N, s);
+        return { O, INV_TWO_PI, pdf(N, O) };
     }
-    inline Vec3 reflect(Float rnd, Float Fr, const Vec3& I, const Vec3& N) const {
-        return random_hemi_vector(N);
+    inline Vec3 eval(const Vec3& I, const Vec3& N, const Vec3& O) const {
+        return R * (INV_PI * std::max(Float(0), N.dot(O)) * INV_TWO_PI);
     }
+    inline Float pdf(const Vec3& N, const Vec3& O) const { return std::max(Float(0), N.dot(O)) * INV_PI; }
+    inline bool diffuse() const { return true; }
+    inline Float lobe() const { return 1; }
+    MaterialRecord record() const { return { MaterialRecord::LAMBERTIAN, R, T, eta, 0 }; }
 };
 
 class Specular : public BxDF {
 public:
     constexpr Specular(const Vec3& R, const Vec3& T, Float eta = 1.0, Float Rho = 1.0) : BxDF(R, T, eta), m_rho(Rho) {}
-    inline Vec3 f() const { return R; }
-    inline Float rho(Float rnd, Float Fr, const Vec3& N, const Vec3& O) const {
-        return m_rho;
-    }
-    inline Vec3 reflect(Float rnd, Float Fr, const Vec3& I, const Vec3& N) const {
-        return reflect_n(I, N);
+    inline BSDFSample sample(const Vec3& I, const Vec3& N, Float rnd, const Vec2& s) const {
+        return { reflect_n(I, N), m_rho, 0 };
     }
+    inline Vec3 eval(const Vec3& I, const Vec3& N, const Vec3& O) const { return Vec3(0); }
+    inline Float pdf(const Vec3& N, const Vec3& O) const { return 0; }
+    inline bool diffuse() const { return false; }
+    inline Float lobe() const { return 0; }
+    MaterialRecord record() const { return { MaterialRecord::SPECULAR, R, T, eta, m_rho }; }
 private:
-    const Float m_rho;
+    Float m_rho;
 };
 
+// mirror lobe weighted by Fresnel, diffuse lobe picked with probability m_roughness
 class DiElectric : public BxDF {
 public:
     constexpr DiElectric(const Vec3& R, const Vec3& T, Float eta = 1.0, Float r = 0.5)
         : BxDF(R, T, eta), m_roughness(r) {}
 
-    inline Vec3 f() const { return R; }
-    inline Float rho(Float rnd, Float Fr, const Vec3& N, const Vec3& O) const {
-        if (rnd >= m_roughness)
-            return (1.0 - Fr) + Fr * N.dot(O);
-        else 
-            return INV_PI * N.dot(O) * Fr;
+    inline BSDFSample sample(const Vec3& I, const Vec3& N, Float rnd, const Vec2& s) const {
+        const Float Fr = fresnel(I, N, 1.0, eta);
+        if (rnd >= m_roughness) {
+            const Vec3 O = reflect_n(I, N);
+            return { O, Float((1.0 - Fr) + Fr * N.dot(O)), 0 };
+        }
+        const Vec3 O = cosine_hemi_vector(N, s);
+        return { O, Fr * INV_TWO_PI, pdf(N, O) };
     }
-    inline Vec3 reflect(Float rnd, Float Fr, const Vec3& I, const Vec3& N) const {
-        if (rnd >= m_roughness)
-            return reflect_n(I, N);
-        else
-            return random_hemi_vector(N);
+    inline Vec3 eval(const Vec3& I, const Vec3& N, const Vec3& O) const {
+        const Float Fr = fresnel(I, N, 1.0, eta);
+        return R * (INV_PI * std::max(Float(0), N.dot(O)) * Fr * m_roughness * INV_TWO_PI);
     }
+    inline Float pdf(const Vec3& N, const Vec3& O) const { return m_roughness * std::max(Float(0), N.dot(O)) * INV_PI; }
+    inline bool diffuse() const { return m_roughness > 0; }
+    inline Float lobe() const { return m_roughness; }
+    MaterialRecord record() const { return { MaterialRecord::DIELECTRIC, R, T, eta, m_roughness }; }
 
 private:
     Float m_roughness{ 0.0 };
 };
 
-inline Float fresnel(const Vec3 &I, const Vec3 &N, Float etaI, Float etaT) {
-    Float cosThetaI = -I.dot(N);
-    if (cosThetaI < 0) {
-        std::swap(etaI, etaT);
-        cosThetaI = -cosThetaI;
-    }
-    Float sinThetaI = sqrt(1-cosThetaI*cosThetaI);
-    Float sinThetaT = etaI / etaT * sinThetaI;
-    if (sinThetaT > 1)
-        sinThetaT = 1;
+// black light source, ends the paths that hit it
+class Emissive : public BxDF {
+public:
+    constexpr Emissive(const Vec3& L) : BxDF(Vec3(0), Vec3(0), 1), m_Le(L) {}
+    constexpr Vec3 emission() const { return m_Le; }
+    inline BSDFSample sample(const Vec3& I, const Vec3& N, Float rnd, const Vec2& s) const { return { N, 0, 0 }; }
+    inline Vec3 eval(const Vec3& I, const Vec3& N, const Vec3& O) const { return Vec3(0); }
+    inline Float pdf(const Vec3& N, const Vec3& O) const { return 0; }
+    inline bool diffuse() const { return false; }
+    inline Float lobe() const { return 0; }
+    MaterialRecord record() const { return { MaterialRecord::EMISSIVE, m_Le, T, eta, 0 }; }
+private:
+    Vec3 m_Le;
+};
 
-    Float cosThetaT = sqrt(1-sinThetaT*sinThetaT);
+// one of the BxDFs by value, Le is kept outside so emission checks need no dispatch
+class Material {
+public:
+    template <typename B>
+    constexpr Material(const B &bxdf)
+        : Le(bxdf.emission())
+        , m_bxdf(bxdf) {}
 
-    Float TI = etaT * cosThetaI;
-    Float TT = etaT * cosThetaT;
-    Float IT = etaI * cosThetaT;
-    Float II = etaI * cosThetaI;
+    // calls f with the concrete BxDF
+    template <typename F>
+    inline decltype(auto) visit(F &&f) const { return std::visit(std::forward<F>(f), m_bxdf); }
 
-    Float Rparl = (TI - IT) / (TI + IT);
-    Float Rperp = (II - TT) / (II + TT);
+    inline Vec3 f() const { return visit([](const auto &b) { return b.f(); }); }
+    inline bool diffuse() const { return visit([](const auto &b) { return b.diffuse(); }); }
+    inline bool emissive() const { return Le.max() > 0; }
+    inline MaterialRecord record() const { return visit([](const auto &b) { return b.record(); }); }
 
-    return 0.5 * (Rparl * Rparl + Rperp * Rperp);
+    Vec3 Le; // emitted radiance
+
+private:
+    std::variant<Lambertion, Specular, DiElectric, Emissive> m_bxdf;
+};
+
+inline std::optional<Material> make_material(const MaterialRecord &m) {
+    switch (m.kind) {
+        case MaterialRecord::LAMBERTIAN: return Lambertion(m.R, m.T, m.eta);
+        case MaterialRecord::SPECULAR: return Specular(m.R, m.T, m.eta, m.param);
+        case MaterialRecord::DIELECTRIC: return DiElectric(m.R, m.T, m.eta, m.param);
+        case MaterialRecord::EMISSIVE: return Emissive(m.R);
+    }
+    return std::nullopt;
 }
 
 static constexpr Lambertion    DIFFUSE_WHITE( Vec3(1), Vec3(0));
 static constexpr DiElectric DIELECTRIC_WHITE( Vec3(1), Vec3(0), 1.1, 0.1);
 static constexpr DiElectric  DIELECTRIC_GOLD( Vec3(244, 202, 104) / 255.0, Vec3(0), 1.1, 0.0);
-static constexpr DiElectric           GROUND( Vec3(1), Vec3(0), 1.0, 0.5);
\ No newline at end of file
+static constexpr DiElectric           GROUND( Vec3(1), Vec3(0), 1.0, 0.5);
+static constexpr Emissive        LIGHT_WARM( Vec3(1.0, 0.85, 0.6) * 40);
@@ -0,0 +1,521 @@
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <iostream>
+
+// area weighted vertex normals, for parts without normals that share the buffer with smooth ones
+static std::vector<Vec3> vertex_normals(const Mesh &mesh) {
+    std::vector<Vec3> normals(mesh.vertices.size(), Vec3(0));
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        const Vec3 &p = mesh.vertices[mesh.indices[i]];
+        const Vec3 n = (mesh.vertices[mesh.indices[i+1]] - p).cross(mesh.vertices[mesh.indices[i+2]] - p);
+        for (int k = 0; k < 3; k++)
+            normals[mesh.indices[i+k]] += n;
+    }
+    for (Vec3 &n : normals) {
+        if (n.norm_sqr() > 0)
+            n = n.normalize();
+    }
+    return normals;
+}
+
+void Mesh::append(const Mesh &part, uint16_t M) {
+    if (!part.normals.empty() && normals.empty() && !vertices.empty())
+        normals = vertex_normals(*this);
+
+    const uint32_t offset = vertices.size();
+    vertices.insert(vertices.end(), part.vertices.begin(), part.vertices.end());
+    if (!part.normals.empty())
+        normals.insert(normals.end(), part.normals.begin(), part.normals.end());
+    else if (!normals.empty()) {
+        const std::vector<Vec3> n = vertex_normals(part);
+        normals.insert(normals.end(), n.begin(), n.end());
+    }
+
+    indices.reserve(indices.size() + part.indices.size());
+    for (uint32_t i : part.indices)
+        indices.push_back(i + offset);
+
+    material.resize(indices.size() / 3, M);
+}
+
+// runs f(i) for i in [0, n) on up to `threads` threads
+template <typename F>
+static void parallel_for(int n, int threads, F &&f) {
+    const int workers = std::max(1, std::min(n, threads));
+    std::vector<std::thread> pool;
+    for (int t = 1; t < workers; t++)
+        pool.emplace_back([&, t]() {
+            for (int i = t; i < n; i += workers)
+                f(i);
+        });
+    for (int i = 0; i < n; i += workers)
+        f(i);
+    for (std::thread &t : pool)
+        t.join();
+}
+
+/*
+    OBJ
+    The file is cut into chunks at line breaks and every chunk is parsed on its own.
+    Negative (relative) indices only know their chunk local vertex count, they are
+    tagged and resolved once the vertex counts of all previous chunks are known.
+*/
+namespace obj {
+
+constexpr int64_t RELATIVE = int64_t(1) << 62;
+constexpr int64_t MISSING = -1;
+
+struct Corner {
+    int64_t v, n;
+};
+
+struct Chunk {
+    std::vector<Vec3> v;
+    std::vector<Vec3> vn;
+    std::vector<Corner> corners; // three per triangle
+    bool failed{ false };
+};
+
+inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+inline const char *parse_float(const char *p, const char *end, Float &x) {
+    p = skip_space(p, end);
+    if (p < end && *p == '+')
+        p++;
+    auto r = std::from_chars(p, end, x);
+    return r.ec == std::errc() ? r.ptr : nullptr;
+}
+
+// 1 based or negative index, returns the encoded corner index
+inline const char *parse_index(const char *p, const char *end, size_t count, int64_t &index) {
+    int64_t i = 0;
+    auto r = std::from_chars(p, end, i);
+    if (r.ec != std::errc() || i == 0)
+        return nullptr;
+    // relative indices may point into earlier chunks, so the chunk local value can be negative
+    index = i > 0 ? i - 1 : RELATIVE + int64_t(count) + i;
+    return r.ptr;
+}
+
+void parse(const char *p, const char *end, Chunk &chunk) {
+    std::vector<Corner> polygon;
+    while (p < end) {
+        const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+        const char *q = skip_space(p, eol);
+
+        if (eol - q > 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+            Vec3 x;
+            if (!(q = parse_float(q + 2, eol, x.x)) || !(q = parse_float(q, eol, x.y)) || !(q = parse_float(q, eol, x.z))) {
+                chunk.failed = true;
+                return;
+            }
+            chunk.v.push_back(x);
+        }
+        else if (eol - q > 3 && q[0] == 'v' && q[1] == 'n' && (q[2] == ' ' || q[2] == '\t')) {
+            Vec3 x;
+            if (!(q = parse_float(q + 3, eol, x.x)) || !(q = parse_float(q, eol, x.y)) || !(q = parse_float(q, eol, x.z))) {
+                chunk.failed = true;
+                return;
+            }
+            chunk.vn.push_back(x);
+        }
+        else if (eol - q > 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+            polygon.clear();
+            q = skip_space(q + 2, eol);
+            while (q < eol) {
+                Corner c{ 0, MISSING };
+                int64_t unused;
+                if (!(q = parse_index(q, eol, chunk.v.size(), c.v))) {
+                    chunk.failed = true;
+                    return;
+                }
+                if (q < eol && *q == '/') {
+                    q++;
+                    if (q < eol && *q != '/' && !(q = parse_index(q, eol, 0, unused))) {
+                        chunk.failed = true;
+                        return;
+                    }
+                    if (q < eol && *q == '/' && !(q = parse_index(q + 1, eol, chunk.vn.size(), c.n))) {
+                        chunk.failed = true;
+                        return;
+                    }
+                }
+                polygon.push_back(c);
+                q = skip_space(q, eol);
+            }
+            for (size_t k = 2; k < polygon.size(); k++) {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[k-1]);
+                chunk.corners.push_back(polygon[k]);
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+bool load(const MappedFile &file, Mesh &mesh, int threads) {
+    const int chunks = std::max(1, std::min<int>(threads * 4, file.size >> 16));
+    std::vector<const char*> bounds(chunks + 1);
+    bounds[0] = file.data;
+    bounds[chunks] = file.data + file.size;
+    for (int c = 1; c < chunks; c++) {
+        const char *p = file.data + file.size * c / chunks;
+        p = std::max(p, bounds[c-1]);
+        const char *eol = static_cast<const char*>(memchr(p, '\n', bounds[chunks] - p));
+        bounds[c] = eol ? eol + 1 : bounds[chunks];
+    }
+
+    std::vector<Chunk> parsed(chunks);
+    parallel_for(chunks, threads, [&](int c) { parse(bounds[c], bounds[c+1], parsed[c]); });
+
+    size_t vcount = 0, ncount = 0, ccount = 0;
+    bool haveNormals = true;
+    std::vector<size_t> vbase(chunks), nbase(chunks), cbase(chunks);
+    for (int c = 0; c < chunks; c++) {
+        if (parsed[c].failed)
+            return false;
+        vbase[c] = vcount;
+        nbase[c] = ncount;
+        cbase[c] = ccount;
+        vcount += parsed[c].v.size();
+        ncount += parsed[c].vn.size();
+        ccount += parsed[c].corners.size();
+    }
+
+    // resolve relative indices, check bounds and whether every corner has a normal
+    std::vector<Corner> corners(ccount);
+    std::vector<char> valid(chunks, 1), normals(chunks, 1), shared(chunks, 1);
+    parallel_for(chunks, threads, [&](int c) {
+        for (size_t k = 0; k < parsed[c].corners.size(); k++) {
+            Corner x = parsed[c].corners[k];
+            if (x.v >= RELATIVE / 2)
+                x.v = x.v - RELATIVE + vbase[c];
+            if (x.n >= RELATIVE / 2)
+                x.n = x.n - RELATIVE + nbase[c];
+            if (x.v < 0 || size_t(x.v) >= vcount || (x.n != MISSING && (x.n < 0 || size_t(x.n) >= ncount)))
+                valid[c] = 0;
+            if (x.n == MISSING)
+                normals[c] = 0;
+            else if (x.n != x.v)
+                shared[c] = 0;
+            corners[cbase[c] + k] = x;
+        }
+    });
+
+    bool sameIndices = ncount == vcount;
+    for (int c = 0; c < chunks; c++) {
+        if (!valid[c])
+            return false;
+        haveNormals &= normals[c] != 0;
+        sameIndices &= shared[c] != 0;
+    }
+    haveNormals &= ncount > 0;
+
+    std::vector<Vec3> v, vn;
+    v.reserve(vcount);
+    vn.reserve(ncount);
+    for (const Chunk &c : parsed) {
+        v.insert(v.end(), c.v.begin(), c.v.end());
+        vn.insert(vn.end(), c.vn.begin(), c.vn.end());
+    }
+
+    mesh.indices.resize(ccount);
+    if (!haveNormals || sameIndices) {
+        mesh.vertices = std::move(v);
+        if (haveNormals)
+            mesh.normals = std::move(vn);
+        for (size_t k = 0; k < ccount; k++)
+            mesh.indices[k] = corners[k].v;
+    }
+    else {
+        // positions and normals are indexed separately, every distinct pair becomes a vertex
+        std::unordered_map<uint64_t, uint32_t> pairs;
+        pairs.reserve(vcount);
+        for (size_t k = 0; k < ccount; k++) {
+            const uint64_t key = (uint64_t(corners[k].v) << 32) | uint64_t(corners[k].n);
+            auto [it, inserted] = pairs.try_emplace(key, mesh.vertices.size());
+            if (inserted) {
+                mesh.vertices.push_back(v[corners[k].v]);
+                mesh.normals.push_back(vn[corners[k].n]);
+            }
+            mesh.indices[k] = it->second;
+        }
+    }
+    return true;
+}
+
+}
+
+/*
+    binary little endian PLY
+    Reads the vertex positions (and normals, if present) and the face index lists.
+    Vertices are converted in parallel. Faces are too when they are all triangles,
+    which is checked, otherwise they are walked once.
+*/
+namespace ply {
+
+enum Type { INVALID, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+struct Property {
+    std::string name;
+    Type type{ INVALID };
+    Type countType{ INVALID }; // list properties only
+    size_t offset{ 0 };
+};
+
+struct Element {
+    std::string name;
+    size_t count{ 0 };
+    std::vector<Property> properties;
+    size_t stride{ 0 }; // 0 if the element has list properties
+};
+
+Type parse_type(const std::string &s) {
+    if (s == "char" || s == "int8") return INT8;
+    if (s == "uchar" || s == "uint8") return UINT8;
+    if (s == "short" || s == "int16") return INT16;
+    if (s == "ushort" || s == "uint16") return UINT16;
+    if (s == "int" || s == "int32") return INT32;
+    if (s == "uint" || s == "uint32") return UINT32;
+    if (s == "float" || s == "float32") return FLOAT32;
+    if (s == "double" || s == "float64") return FLOAT64;
+    return INVALID;
+}
+
+constexpr size_t size_of(Type t) {
+    constexpr size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[t];
+}
+
+template <typename T>
+inline T read(const char *p) {
+    T x;
+    memcpy(&x, p, sizeof(T));
+    return x;
+}
+
+inline double read_value(const char *p, Type t) {
+    switch (t) {
+        case INT8: return read<int8_t>(p);
+        case UINT8: return read<uint8_t>(p);
+        case INT16: return read<int16_t>(p);
+        case UINT16: return read<uint16_t>(p);
+        case INT32: return read<int32_t>(p);
+        case UINT32: return read<uint32_t>(p);
+        case FLOAT32: return read<float>(p);
+        case FLOAT64: return read<double>(p);
+        default: return 0;
+    }
+}
+
+bool load(const MappedFile &file, Mesh &mesh, int threads) {
+    const char *end = file.data + file.size;
+    if (file.size < 4 || memcmp(file.data, "ply", 3) != 0)
+        return false;
+    const char *header_end = static_cast<const char*>(memmem(file.data, file.size, "end_header", 10));
+    if (!header_end)
+        return false;
+    const char *p = static_cast<const char*>(memchr(header_end, '\n', end - header_end));
+    if (!p)
+        return false;
+    p++;
+
+    // header
+    std::vector<Element> elements;
+    bool binary = false;
+    {
+        const std::string header(file.data, header_end);
+        size_t pos = 0;
+        while (pos < header.size()) {
+            size_t eol = header.find('\n', pos);
+            if (eol == std::string::npos)
+                eol = header.size();
+            std::vector<std::string> words;
+            size_t w = pos;
+            while (w < eol) {
+                while (w < eol && isspace(header[w])) w++;
+                size_t e = w;
+                while (e < eol && !isspace(header[e])) e++;
+                if (e > w)
+                    words.emplace_back(header, w, e - w);
+                w = e;
+            }
+            pos = eol + 1;
+
+            if (words.empty())
+                continue;
+            if (words[0] == "format") {
+                binary = words.size() > 1 && words[1] == "binary_little_endian";
+            }
+            else if (words[0] == "element" && words.size() == 3) {
+                Element &e = elements.emplace_back();
+                e.name = words[1];
+                const char *last = words[2].data() + words[2].size();
+                const auto r = std::from_chars(words[2].data(), last, e.count);
+                if (r.ec != std::errc() || r.ptr != last)
+                    return false;
+            }
+            else if (words[0] == "property" && !elements.empty()) {
+                Property prop;
+                if (words.size() == 5 && words[1] == "list") {
+                    prop.countType = parse_type(words[2]);
+                    prop.type = parse_type(words[3]);
+                    prop.name = words[4];
+                    if (prop.countType == INVALID)
+                        return false;
+                }
+                else if (words.size() == 3) {
+                    prop.type = parse_type(words[1]);
+                    prop.name = words[2];
+                }
+                if (prop.type == INVALID)
+                    return false;
+                elements.back().properties.push_back(prop);
+            }
+        }
+    }
+    if (!binary)
+        return false;
+
+    for (Element &e : elements) {
+        size_t offset = 0;
+        for (Property &prop : e.properties) {
+            prop.offset = offset;
+            if (prop.countType != INVALID) {
+                offset = 0;
+                break;
+            }
+            offset += size_of(prop.type);
+        }
+        e.stride = offset;
+    }
+
+    for (const Element &e : elements) {
+        if (e.name == "vertex") {
+            if (!e.stride || size_t(end - p) / e.stride < e.count)
+                return false;
+            const Property *x[3] = {}, *n[3] = {};
+            for (const Property &prop : e.properties) {
+                for (int k = 0; k < 3; k++) {
+                    if (prop.name == std::string(1, "xyz"[k])) x[k] = &prop;
+                    if (prop.name == std::string("n") + "xyz"[k]) n[k] = &prop;
+                }
+            }
+            if (!x[0] || !x[1] || !x[2])
+                return false;
+            const bool haveNormals = n[0] && n[1] && n[2];
+
+            mesh.vertices.resize(e.count);
+            if (haveNormals)
+                mesh.normals.resize(e.count);
+            const int chunks = std::max(1, threads);
+            parallel_for(chunks, threads, [&](int c) {
+                for (size_t i = e.count * c / chunks; i < e.count * (c+1) / chunks; i++) {
+                    const char *v = p + i * e.stride;
+                    mesh.vertices[i] = Vec3(read_value(v + x[0]->offset, x[0]->type),
+                        read_value(v + x[1]->offset, x[1]->type), read_value(v + x[2]->offset, x[2]->type));
+                    if (haveNormals)
+                        mesh.normals[i] = Vec3(read_value(v + n[0]->offset, n[0]->type),
+                            read_value(v + n[1]->offset, n[1]->type), read_value(v + n[2]->offset, n[2]->type));
+                }
+            });
+            p += e.count * e.stride;
+        }
+        else if (e.name == "face") {
+            if (e.properties.size() != 1 || e.properties[0].countType == INVALID)
+                return false;
+            const Type ct = e.properties[0].countType;
+            const Type it = e.properties[0].type;
+            const size_t cs = size_of(ct), is = size_of(it);
+            const size_t triangle = cs + 3 * is;
+
+            // all triangles: fixed stride, convert in parallel and check the counts on the way
+            bool fixed = size_t(end - p) / triangle >= e.count;
+            if (fixed) {
+                mesh.indices.resize(3 * e.count);
+                const int chunks = std::max(1, threads);
+                std::vector<char> ok(chunks, 1);
+                parallel_for(chunks, threads, [&](int c) {
+                    for (size_t i = e.count * c / chunks; i < e.count * (c+1) / chunks; i++) {
+                        const char *f = p + i * triangle;
+                        if (read_value(f, ct) != 3) {
+                            ok[c] = 0;
+                            return;
+                        }
+                        for (int k = 0; k < 3; k++)
+                            mesh.indices[3*i + k] = uint32_t(read_value(f + cs + k * is, it));
+                    }
+                });
+                for (char o : ok)
+                    fixed &= o != 0;
+            }
+            if (fixed) {
+                p += e.count * triangle;
+            }
+            else {
+                mesh.indices.clear();
+                for (size_t i = 0; i < e.count; i++) {
+                    if (p + cs > end)
+                        return false;
+                    const size_t count = size_t(read_value(p, ct));
+                    p += cs;
+                    if (size_t(end - p) / is < count)
+                        return false;
+                    for (size_t k = 2; k < count; k++) {
+                        mesh.indices.push_back(uint32_t(read_value(p, it)));
+                        mesh.indices.push_back(uint32_t(read_value(p + (k-1) * is, it)));
+                        mesh.indices.push_back(uint32_t(read_value(p + k * is, it)));
+                    }
+                    p += count * is;
+                }
+            }
+        }
+        else {
+            // anything else is skipped, which needs a fixed size
+            if (!e.stride || size_t(end - p) / e.stride < e.count)
+                return false;
+            p += e.count * e.stride;
+        }
+    }
+
+    for (uint32_t i : mesh.indices) {
+        if (i >= mesh.vertices.size())
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool load_mesh(const std::string &path, Mesh &mesh, int threads) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << path << ": can't read file\n";
+        return false;
+    }
+
+    Mesh part;
+    bool ok;
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".ply") == 0)
+        ok = ply::load(file, part, threads);
+    else
+        ok = obj::load(file, part, threads);
+
+    if (!ok) {
+        std::cerr << path << ": unsupported or malformed mesh\n";
+        return false;
+    }
+
+    mesh = std::move(part);
+    return true;
+}
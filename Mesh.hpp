@@ -0,0 +1,61 @@
+#pragma once
+#include "Object.hpp"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/*
+    Triangle meshes sharing one vertex and normal buffer, triangles are three
+    32 bit vertex indices. Every triangle stores the index of its material
+    in Scene::materials.
+*/
+struct Mesh {
+    std::vector<Vec3> vertices;
+    std::vector<Vec3> normals;      // per vertex, empty if no part came with normals
+    std::vector<uint32_t> indices;  // three per triangle
+    std::vector<uint16_t> material; // per triangle
+
+    inline size_t triangles() const { return indices.size() / 3; }
+
+    inline size_t bytes() const {
+        return vertices.size() * sizeof(Vec3) + normals.size() * sizeof(Vec3)
+             + indices.size() * sizeof(uint32_t) + material.size() * sizeof(uint16_t);
+    }
+
+    inline bool hit(uint32_t tri, Interaction * const interaction) const {
+        const uint32_t *i = &indices[3*tri];
+        const Vec3 &p = vertices[i[0]];
+        const Vec3 u = vertices[i[1]] - p;
+        const Vec3 v = vertices[i[2]] - p;
+        return Triangle::intersect(p, u, v, u.cross(v), interaction);
+    }
+
+    inline Vec3 normalAt(uint32_t tri, const Interaction * const interaction) const {
+        const uint32_t *i = &indices[3*tri];
+        if (normals.empty()) {
+            const Vec3 &p = vertices[i[0]];
+            return (vertices[i[1]] - p).cross(vertices[i[2]] - p).normalize();
+        }
+        const Vec3 &uv = interaction->uv;
+        return (normals[i[0]] * (1 - uv.x - uv.y) + normals[i[1]] * uv.x + normals[i[2]] * uv.y).normalize();
+    }
+
+    inline AABB bounds(uint32_t tri) const {
+        const uint32_t *i = &indices[3*tri];
+        AABB b(vertices[i[0]], vertices[i[0]]);
+        b.extend(vertices[i[1]]);
+        b.extend(vertices[i[2]]);
+        return b;
+    }
+
+    // appends another mesh as a part with the given material
+    void append(const Mesh &part, uint16_t M);
+};
+
+/*
+    Loads a Wavefront .obj or binary little endian .ply file through mmap into
+    mesh (without materials, see Mesh::append), parsing with the given number of
+    threads. Polygons are fanned into triangles.
+    Prints the reason and returns false if the file can't be read.
+*/
+bool load_mesh(const std::string &path, Mesh &mesh, int threads);
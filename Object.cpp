@@ -1,6 +1,10 @@
 #include "Object.hpp"
 
 bool Triangle::hit(Interaction * const interaction) const {
+    return intersect(position, u, v, true_normal, interaction);
+}
+
+bool Triangle::intersect(const Vec3 &position, const Vec3 &u, const Vec3 &v, const Vec3 &true_normal, Interaction * const interaction) {
     const Ray &ray = *(interaction->ray);
     const Float det = ray.direction.dot(true_normal);
     if (det >= 0) {
@@ -9,7 +13,11 @@ bool Triangle::hit(Interaction * const interaction) const {
 
     const Vec3 delta = ray.position - position;
     const Float t = true_normal.dot(delta);
-    if (interaction->type != TYPE::NONE && t <= interaction->t*det) {
+    // the plane is behind the ray
+    if (t <= 0) {
+        return false;
+    }
+    if (interaction->object.type != TYPE::NONE && -t <= interaction->t*det) {
         return false;
     }
 
@@ -17,15 +25,13 @@ bool Triangle::hit(Interaction * const interaction) const {
     const Float a = -cross.dot(v);
     const Float b = cross.dot(u);
 
-    if (a > 0 || b > 0 || det > a || det > b) {
+    if (a > 0 || b > 0 || det > a || det > b || det > a + b) {
         return false;
     }
 
     const Float inv_det = 1/det;
-    interaction->type = TYPE::TRIANGLE;
     interaction->t = -t*inv_det;
     interaction->uv = Vec3(a*inv_det, b*inv_det, 0);
-    interaction->object = this;
 
     return true;
 }
@@ -49,13 +55,11 @@ bool Sphere::hit(Interaction * const interaction) const {
         t -= disc_sqrt;
     }
 
-    if (interaction->type != TYPE::NONE && interaction->t < t)
+    if (interaction->object.type != TYPE::NONE && interaction->t < t)
         return false;
 
-    interaction->type = TYPE::SPHERE;
     interaction->t = t;
     interaction->uv = Vec3(0, 0, 0);
-    interaction->object = this;
 
     return true;
 }
@@ -67,13 +71,11 @@ bool Plane::hit(Interaction * const interaction) const {
         return false;
 
     Float num = hesse_const - position.dot(ray.position);
-    if (interaction->type != TYPE::NONE && num <= interaction->t*den)
+    if (interaction->object.type != TYPE::NONE && num <= interaction->t*den)
         return false;
     
-    interaction->type = TYPE::PLANE;
     interaction->t = num / den;
     interaction->uv = Vec3(0);
-    interaction->object = this;
 
     return true;
 }
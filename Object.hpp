@@ -2,42 +2,52 @@
 #include "Vector.hpp"
 #include "Ray.hpp"
 #include "Material.hpp"
+#include "AABB.hpp"
+#include "Transform.hpp"
 
-enum TYPE { NONE, SPHERE, TRIANGLE, PLANE };
+#include <cstdint>
 
-struct Interaction;
+enum TYPE : uint8_t { NONE, SPHERE, TRIANGLE, PLANE, MESH, INSTANCE };
 
+// refers to a primitive by its type and index into the scene's array of that type
+struct Handle {
+    TYPE type{ NONE };
+    uint32_t index{ 0 };
+    uint32_t primitive{ 0 }; // INSTANCE: the triangle of its geometry
+
+    constexpr bool operator==(const Handle &h) const { return type == h.type && index == h.index && primitive == h.primitive; }
+};
+
+/*
+    Common data of all primitives. There are no virtual functions,
+    the Scene keeps every type in its own array and dispatches on Handle::type.
+*/
 class Object {
 public:
     Vec3 position;
-    const BxDF * material{ nullptr };
+    uint32_t material{ 0 }; // index into Scene::materials
 
     Object() = delete;
-    constexpr Object(const Vec3 &P, const BxDF * const M) : position(P), material(M) {}
-
-    virtual bool hit(Interaction * const interaction) const = 0;
-    virtual Vec3 normalAt(const Interaction * const interaction) const = 0;
+    constexpr Object(const Vec3 &P, const uint32_t M) : position(P), material(M) {}
 };
 
+/*
+    hit() only fills in t and uv of a closer crossing and returns true,
+    the caller records which primitive it was in object.
+*/
 struct Interaction {
-    TYPE type{NONE};
     const Ray* ray;
     Float t;
 
     Vec3 uv; // coord. of crossing relative to object coordinates
-    const Object* object;
+    Handle object;
 
     Vec3 position;
     Vec3 normal;
 
     Interaction() = delete;
 
-    constexpr Interaction(const Ray *r) : type(NONE), t(0), uv(0), object(nullptr), ray(r) {}
-
-    inline void update() {
-        position = ray->at(t);
-        normal = object->normalAt(this);
-    }
+    constexpr Interaction(const Ray *r) : ray(r), t(0), uv(0), object() {}
 };
 
 class Triangle : public Object {
@@ -47,22 +57,32 @@ public:
     Vec3 corner_normals[3];
 
     Triangle() = delete;
-    constexpr Triangle(const Vec3 &P, const Vec3 &U, const Vec3 &V, const BxDF * const M)
+    constexpr Triangle(const Vec3 &P, const Vec3 &U, const Vec3 &V, const uint32_t M)
         : Object(P, M), u(U), v(V)
         , true_normal(U.cross(V))
         , corner_normals{true_normal, true_normal, true_normal}
     {}
 
-    constexpr Triangle(const Vec3 &P, const Vec3 &U, const Vec3 &V, const Vec3 (&n)[3], const BxDF * const M)
+    constexpr Triangle(const Vec3 &P, const Vec3 &U, const Vec3 &V, const Vec3 (&n)[3], const uint32_t M)
         : Object(P, M), u(U), v(V)
         , true_normal(U.cross(V))
         , corner_normals{n[0], n[1], n[2]}
     {}
 
     bool hit(Interaction * const interaction) const;
+
+    // front facing crossing with the triangle P, P+U, P+V where N = U x V, also used for indexed meshes
+    static bool intersect(const Vec3 &P, const Vec3 &U, const Vec3 &V, const Vec3 &N, Interaction * const interaction);
+
     inline Vec3 normalAt(const Interaction * const i) const {
         return (corner_normals[0] * (1 - i->uv.x - i->uv.y) + corner_normals[1] * i->uv.x + corner_normals[2] * i->uv.y).normalize();
     }
+    inline AABB bounds() const {
+        AABB b(position, position);
+        b.extend(position + u);
+        b.extend(position + v);
+        return b;
+    }
 
 };
 
@@ -71,11 +91,12 @@ public:
     Float radius;
 
     Sphere() = delete;
-    constexpr Sphere(const Vec3 &P, const Float R, const BxDF * const M) : Object(P, M), radius(R) {}
+    constexpr Sphere(const Vec3 &P, const Float R, const uint32_t M) : Object(P, M), radius(R) {}
 
     bool hit(Interaction * const interaction) const;
 
     inline Vec3 normalAt(const Interaction * const i) const { return (i->position - position).normalize(); }
+    inline AABB bounds() const { return AABB(position - Vec3(radius), position + Vec3(radius)); }
 };
 
 class Plane : public Object {
@@ -86,8 +107,31 @@ public:
     Float hesse_const;
 
     Plane() = delete;
-    constexpr Plane(const Vec3 &N, Float d, const BxDF * const M) : Object(N.normalize(), M), hesse_const(d / N.norm()) {}
+    constexpr Plane(const Vec3 &N, Float d, const uint32_t M) : Object(N.normalize(), M), hesse_const(d / N.norm()) {}
 
     bool hit(Interaction * const interaction) const;
     inline Vec3 normalAt(const Interaction * const interaction) const { return position; }
-};
\ No newline at end of file
+    inline AABB bounds() const { return AABB::Unbounded(); }
+};
+
+/*
+    A placed copy of one of the Scene's geometries. Rays are moved into the
+    geometry's object space with toObject and traverse its own BVH there, the
+    world space bounds go into the scene's BVH. material replaces the
+    geometry's materials unless it is OWN_MATERIAL. Mirroring transforms turn
+    the triangles' front faces inside out.
+*/
+class Instance {
+public:
+    static constexpr uint32_t OWN_MATERIAL = ~0u;
+
+    Transform toWorld;
+    Transform toObject;
+    uint32_t geometry;
+    uint32_t material;
+    AABB bounds; // world space, filled in by Scene::build()
+
+    Instance() = delete;
+    constexpr Instance(uint32_t G, const Transform &T, uint32_t M = OWN_MATERIAL)
+        : toWorld(T), toObject(T.inverse()), geometry(G), material(M) {}
+};
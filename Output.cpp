@@ -0,0 +1,355 @@
+#include "Output.hpp"
+#include "Color.hpp"
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+// all formats are written little endian, as the floats are in memory on x86
+static_assert(sizeof(Float) == 4, "image outputs write 32 bit floats");
+
+ImageOutput::~ImageOutput() {
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+void ImageOutput::write(const void *data, size_t size, uint64_t offset) {
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = pwrite(m_fd, p, size, offset);
+        if (n <= 0) {
+            m_failed = true;
+            return;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+void ImageOutput::tile(int x, int y, int w, int h) {
+    if (m_mode == PWRITE) {
+        for (int i = y; i < y + h; i++)
+            writeRow(x, i, w);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_bandPixels[y / m_band] += w * h;
+
+    // appends every complete band that is next in the file
+    const int bands = m_bandPixels.size();
+    while (m_nextBand < bands) {
+        const int b = bottomUp() ? bands - 1 - m_nextBand : m_nextBand;
+        const int first = b * m_band;
+        const int last = std::min(first + m_band, m_height);
+        if (m_bandPixels[b] < uint32_t((last - first) * m_width))
+            break;
+
+        m_buffer.clear();
+        for (int i = 0; i < last - first; i++)
+            encodeRow(bottomUp() ? last - 1 - i : first + i, m_offset + m_buffer.size(), m_buffer);
+        write(m_buffer.data(), m_buffer.size(), m_offset);
+        m_offset += m_buffer.size();
+        m_nextBand++;
+    }
+}
+
+bool ImageOutput::finish() {
+    if (m_mode == STREAM && m_nextBand < int(m_bandPixels.size())) {
+        std::cerr << m_path << ": image is incomplete\n";
+        return false;
+    }
+    end();
+    if (m_failed)
+        std::cerr << m_path << ": write failed\n";
+    close(m_fd);
+    m_fd = -1;
+    return !m_failed;
+}
+
+namespace {
+
+// formats storing rows as packed pixels, PPM and PFM
+class PackedOutput : public ImageOutput {
+public:
+    PackedOutput(const Vec3 *image, int width, int height, int pixelBytes, bool bottomUp)
+        : ImageOutput(image, width, height), m_pixelBytes(pixelBytes), m_bottomUp(bottomUp) {}
+
+protected:
+    bool fixed() const { return true; }
+    bool bottomUp() const { return m_bottomUp; }
+
+    uint64_t start(Mode mode) {
+        const std::string h = header();
+        write(h.data(), h.size(), 0);
+        m_start = h.size();
+        return m_start;
+    }
+
+    void writeRow(int x, int y, int w) {
+        m_row.resize(size_t(w) * m_pixelBytes);
+        convert(&m_image[size_t(y) * m_width + x], w, m_row.data());
+        const int row = m_bottomUp ? m_height - 1 - y : y;
+        write(m_row.data(), m_row.size(), m_start + (uint64_t(row) * m_width + x) * m_pixelBytes);
+    }
+
+    void encodeRow(int y, uint64_t offset, std::vector<char> &out) {
+        const size_t size = out.size();
+        out.resize(size + size_t(m_width) * m_pixelBytes);
+        convert(&m_image[size_t(y) * m_width], m_width, &out[size]);
+    }
+
+    virtual std::string header() const = 0;
+    virtual void convert(const Vec3 *pixels, int n, char *out) const = 0;
+
+private:
+    int m_pixelBytes;
+    bool m_bottomUp;
+    uint64_t m_start{ 0 };
+    static thread_local std::vector<char> m_row;
+};
+
+thread_local std::vector<char> PackedOutput::m_row;
+
+class PPMOutput : public PackedOutput {
+public:
+    PPMOutput(const Vec3 *image, int width, int height) : PackedOutput(image, width, height, 3, false) {}
+
+protected:
+    std::string header() const {
+        return "P6\n" + std::to_string(m_width) + " " + std::to_string(m_height) + "\n255\n";
+    }
+    void convert(const Vec3 *pixels, int n, char *out) const {
+        for (int i = 0; i < n; i++) {
+            *out++ = static_cast<uint8_t>(clamp(pixels[i].r, 0, 1) * 255.0);
+            *out++ = static_cast<uint8_t>(clamp(pixels[i].g, 0, 1) * 255.0);
+            *out++ = static_cast<uint8_t>(clamp(pixels[i].b, 0, 1) * 255.0);
+        }
+    }
+};
+
+// rows bottom to top, a negative scale marks little endian floats
+class PFMOutput : public PackedOutput {
+public:
+    PFMOutput(const Vec3 *image, int width, int height) : PackedOutput(image, width, height, 12, true) {}
+
+protected:
+    std::string header() const {
+        return "PF\n" + std::to_string(m_width) + " " + std::to_string(m_height) + "\n-1.0\n";
+    }
+    void convert(const Vec3 *pixels, int n, char *out) const {
+        for (int i = 0; i < n; i++) {
+            const Float c[3] = { pixels[i].r, pixels[i].g, pixels[i].b };
+            memcpy(out + 12*i, c, 12);
+        }
+    }
+};
+
+/*
+    OpenEXR scanline image with one scanline per chunk and float B, G, R channels.
+    A chunk is the row's y, the size of its data and the data, one channel after
+    the other. Uncompressed chunks all have the same size, so their offsets are
+    known up front. RLE chunks are only known once encoded and are appended in
+    increasing y, the offset table is filled in at the end.
+*/
+class EXROutput : public ImageOutput {
+public:
+    EXROutput(const Vec3 *image, int width, int height, Compression compression)
+        : ImageOutput(image, width, height), m_compression(compression), m_offsets(height, 0) {}
+
+protected:
+    bool fixed() const { return m_compression == NONE; }
+
+    uint64_t start(Mode mode) {
+        std::vector<char> h;
+        h.reserve(512);
+        auto put = [&](const void *p, size_t n) { h.insert(h.end(), static_cast<const char*>(p), static_cast<const char*>(p) + n); };
+        auto put_i32 = [&](int32_t v) { put(&v, 4); };
+        auto put_f32 = [&](float v) { put(&v, 4); };
+        auto attribute = [&](const char *name, const char *type, int32_t size) {
+            put(name, strlen(name) + 1);
+            put(type, strlen(type) + 1);
+            put_i32(size);
+        };
+
+        const uint8_t magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+        put(magic, sizeof(magic));
+
+        attribute("channels", "chlist", 3 * 18 + 1);
+        for (const char *channel : { "B", "G", "R" }) {
+            put(channel, 2);
+            put_i32(2); // FLOAT
+            put_i32(0); // pLinear and reserved
+            put_i32(1); // x sampling
+            put_i32(1); // y sampling
+        }
+        h.push_back(0);
+
+        attribute("compression", "compression", 1);
+        h.push_back(m_compression == RLE ? 1 : 0);
+        for (const char *window : { "dataWindow", "displayWindow" }) {
+            attribute(window, "box2i", 16);
+            put_i32(0); put_i32(0); put_i32(m_width - 1); put_i32(m_height - 1);
+        }
+        attribute("lineOrder", "lineOrder", 1);
+        h.push_back(0); // INCREASING_Y
+        attribute("pixelAspectRatio", "float", 4);
+        put_f32(1);
+        attribute("screenWindowCenter", "v2f", 8);
+        put_f32(0); put_f32(0);
+        attribute("screenWindowWidth", "float", 4);
+        put_f32(1);
+        h.push_back(0);
+
+        m_table = h.size();
+        const uint64_t first = m_table + uint64_t(m_height) * sizeof(uint64_t);
+        if (m_compression == NONE) {
+            for (int y = 0; y < m_height; y++)
+                m_offsets[y] = first + uint64_t(y) * (8 + rowBytes());
+        }
+        put(m_offsets.data(), m_offsets.size() * sizeof(uint64_t));
+        write(h.data(), h.size(), 0);
+
+        if (m_compression == NONE && mode == PWRITE) {
+            // chunk headers go in now, the tiles only fill in the channel data
+            for (int y = 0; y < m_height; y++) {
+                const int32_t chunk[2] = { y, int32_t(rowBytes()) };
+                write(chunk, sizeof(chunk), m_offsets[y]);
+            }
+        }
+        return first;
+    }
+
+    void writeRow(int x, int y, int w) {
+        for (int c = 0; c < 3; c++) {
+            m_row.resize(w);
+            for (int i = 0; i < w; i++)
+                m_row[i] = channel(m_image[size_t(y) * m_width + x + i], c);
+            write(m_row.data(), w * sizeof(float), m_offsets[y] + 8 + (uint64_t(c) * m_width + x) * sizeof(float));
+        }
+    }
+
+    void encodeRow(int y, uint64_t offset, std::vector<char> &out) {
+        m_row.resize(size_t(3) * m_width);
+        for (int c = 0; c < 3; c++) {
+            for (int i = 0; i < m_width; i++)
+                m_row[c * m_width + i] = channel(m_image[size_t(y) * m_width + i], c);
+        }
+
+        const char *data = reinterpret_cast<const char*>(m_row.data());
+        size_t size = rowBytes();
+        if (m_compression == RLE) {
+            rle(data, size, m_packed);
+            // stored raw if compression doesn't pay off, readers tell by the size
+            if (m_packed.size() < size) {
+                data = m_packed.data();
+                size = m_packed.size();
+            }
+        }
+
+        m_offsets[y] = offset;
+        const int32_t chunk[2] = { y, int32_t(size) };
+        out.insert(out.end(), reinterpret_cast<const char*>(chunk), reinterpret_cast<const char*>(chunk) + sizeof(chunk));
+        out.insert(out.end(), data, data + size);
+    }
+
+    void end() {
+        if (m_compression == RLE)
+            write(m_offsets.data(), m_offsets.size() * sizeof(uint64_t), m_table);
+    }
+
+private:
+    Compression m_compression;
+    uint64_t m_table{ 0 };
+    std::vector<uint64_t> m_offsets; // file offset of every row's chunk
+    static thread_local std::vector<float> m_row;
+    static thread_local std::vector<char> m_scratch, m_packed;
+
+    inline size_t rowBytes() const { return size_t(3) * m_width * sizeof(float); }
+
+    static inline float channel(const Vec3 &c, int i) { return i == 0 ? c.b : (i == 1 ? c.g : c.r); }
+
+    /*
+        OpenEXR's RLE: the bytes are split into even and odd positions, delta
+        encoded and then run length encoded. Runs of 3 or more equal bytes become
+        (length - 1, byte), anything else (-length, bytes...), both at most 127 long.
+    */
+    static void rle(const char *in, size_t size, std::vector<char> &out) {
+        m_scratch.resize(size);
+        char *t1 = m_scratch.data();
+        char *t2 = m_scratch.data() + (size + 1) / 2;
+        for (size_t i = 0; i < size; i++)
+            *(i % 2 ? t2++ : t1++) = in[i];
+
+        uint8_t *t = reinterpret_cast<uint8_t*>(m_scratch.data());
+        int p = t[0];
+        for (size_t i = 1; i < size; i++) {
+            const int d = int(t[i]) - p + (128 + 256);
+            p = t[i];
+            t[i] = uint8_t(d);
+        }
+
+        constexpr long MIN_RUN = 3, MAX_RUN = 127;
+        out.clear();
+        const char *begin = m_scratch.data();
+        const char *end = begin + size;
+        const char *run = begin + 1;
+        while (begin < end) {
+            while (run < end && *begin == *run && run - begin - 1 < MAX_RUN)
+                run++;
+            if (run - begin >= MIN_RUN) {
+                out.push_back(char(run - begin - 1));
+                out.push_back(*begin);
+                begin = run;
+            }
+            else {
+                while (run < end && (run + 1 >= end || *run != run[1] || run + 2 >= end || run[1] != run[2]) && run - begin < MAX_RUN)
+                    run++;
+                out.push_back(char(begin - run));
+                out.insert(out.end(), begin, run);
+                begin = run;
+            }
+            run++;
+        }
+    }
+};
+
+thread_local std::vector<float> EXROutput::m_row;
+thread_local std::vector<char> EXROutput::m_scratch;
+thread_local std::vector<char> EXROutput::m_packed;
+
+}
+
+std::unique_ptr<ImageOutput> ImageOutput::open(const std::string &path, const Vec3 *image, int width, int height,
+                                               int band, Mode mode, Compression compression) {
+    auto extension = [&](const char *e) {
+        const size_t n = strlen(e);
+        return path.size() > n && path.compare(path.size() - n, n, e) == 0;
+    };
+
+    std::unique_ptr<ImageOutput> out;
+    if (extension(".ppm"))
+        out.reset(new PPMOutput(image, width, height));
+    else if (extension(".pfm"))
+        out.reset(new PFMOutput(image, width, height));
+    else if (extension(".exr"))
+        out.reset(new EXROutput(image, width, height, compression));
+    else {
+        std::cerr << path << ": unknown image format, use .ppm, .pfm or .exr\n";
+        return nullptr;
+    }
+
+    out->m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out->m_fd < 0) {
+        std::cerr << path << ": can't create file\n";
+        return nullptr;
+    }
+    out->m_path = path;
+    out->m_mode = out->fixed() ? mode : STREAM;
+    out->m_band = std::max(1, band);
+    out->m_bandPixels.assign((height + out->m_band - 1) / out->m_band, 0);
+    out->m_offset = out->start(out->m_mode);
+    return out;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Vector.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+    An image file written while the frame renders. The render threads call tile()
+    for every finished tile of image (width x height, row major), finish() is
+    called once after all tiles are done.
+    Formats with a fixed layout (PPM, PFM and uncompressed EXR) write each tile
+    straight to its place in the file with pwrite. In STREAM mode, and always for
+    RLE compressed EXR, every band of `band` rows is encoded as soon as it is
+    complete and appended in file order with a single write.
+    Tiles must not straddle bands, the tiles of JobList::build with block = band
+    never do.
+*/
+class ImageOutput {
+public:
+    enum Mode { PWRITE, STREAM };
+    enum Compression { NONE, RLE }; // EXR only, the other formats are never compressed
+
+    virtual ~ImageOutput();
+
+    /*
+        Picks the format from the extension of path (.ppm, .pfm or .exr). PPM
+        stores image clamped to 8 bit, PFM and EXR store it as 32 bit floats.
+        Prints the reason and returns nullptr if the file can't be created.
+    */
+    static std::unique_ptr<ImageOutput> open(const std::string &path, const Vec3 *image, int width, int height,
+                                             int band, Mode mode = PWRITE, Compression compression = RLE);
+
+    // writes the tile, may be called from several threads at once
+    void tile(int x, int y, int w, int h);
+
+    // false if any write failed or a band is missing
+    bool finish();
+
+    inline const std::string &path() const { return m_path; }
+
+protected:
+    ImageOutput(const Vec3 *image, int width, int height) : m_image(image), m_width(width), m_height(height) {}
+
+    const Vec3 *m_image;
+    int m_width;
+    int m_height;
+    int m_fd{ -1 };
+    std::atomic<bool> m_failed{ false };
+
+    // writes size bytes at offset, marks the output as failed if that doesn't work
+    void write(const void *data, size_t size, uint64_t offset);
+
+    // true if every row has a fixed place in the file and can be written in any order
+    virtual bool fixed() const = 0;
+
+    // rows are stored from the last to the first
+    virtual bool bottomUp() const { return false; }
+
+    // writes the header and returns where the first row goes
+    virtual uint64_t start(Mode mode) = 0;
+
+    // fixed layouts: writes pixels [x, x+w) of row y to their place in the file
+    virtual void writeRow(int x, int y, int w) = 0;
+
+    // appends row y as it is stored in the file, offset is where out begins in the file
+    virtual void encodeRow(int y, uint64_t offset, std::vector<char> &out) = 0;
+
+    // called after the last row, e.g. to fill in an offset table
+    virtual void end() {}
+
+private:
+    std::string m_path;
+    Mode m_mode{ PWRITE };
+
+    // STREAM mode, bands are appended at m_offset in file order
+    std::mutex m_lock;
+    int m_band{ 1 };
+    std::vector<uint32_t> m_bandPixels;
+    int m_nextBand{ 0 }; // counts bands in file order
+    uint64_t m_offset{ 0 };
+    std::vector<char> m_buffer;
+};
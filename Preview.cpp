@@ -0,0 +1,118 @@
+#include "Preview.hpp"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x56505452; // "RTPV"
+constexpr uint32_t VERSION = 1;
+
+static_assert(sizeof(Vec3) == 3 * sizeof(float), "the segment stores pixels as 3 floats");
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "other processes read the counters as plain integers");
+
+// shm_open wants a name starting with a slash
+std::string segment(const std::string &name) {
+    return name.starts_with('/') ? name : '/' + name;
+}
+
+}
+
+Preview::~Preview() {
+    if (m_data)
+        munmap(m_data, m_size);
+    if (m_owner)
+        shm_unlink(m_name.c_str());
+}
+
+std::unique_ptr<Preview> Preview::create(const std::string &name, int width, int height, int block) {
+    const uint32_t columns = (width + block - 1) / block;
+    const uint32_t rows = (height + block - 1) / block;
+    const size_t table = sizeof(PreviewHeader) + size_t(columns) * rows * sizeof(uint32_t);
+    const size_t pixelOffset = (table + 63) & ~size_t(63);
+    const size_t size = pixelOffset + size_t(width) * height * sizeof(Vec3);
+
+    std::unique_ptr<Preview> preview(new Preview());
+    preview->m_name = segment(name);
+    shm_unlink(preview->m_name.c_str());
+    const int fd = shm_open(preview->m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        std::cerr << name << ": can't create shared memory\n";
+        return nullptr;
+    }
+    preview->m_owner = true;
+    void *data = ftruncate(fd, size) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << name << ": can't map " << size << " bytes of shared memory\n";
+        return nullptr;
+    }
+
+    // a fresh segment is zero: no tile written yet and a black frame
+    preview->m_data = data;
+    preview->m_size = size;
+    preview->m_header = new (data) PreviewHeader{ {}, VERSION, uint32_t(width), uint32_t(height), uint32_t(block),
+                                                 columns, rows, uint32_t(pixelOffset), {}, {}, uint32_t(getpid()) };
+    preview->m_sequence = reinterpret_cast<std::atomic<uint32_t>*>(static_cast<char*>(data) + sizeof(PreviewHeader));
+    preview->m_pixels = reinterpret_cast<Vec3*>(static_cast<char*>(data) + pixelOffset);
+    // viewers only trust the segment once the header is complete
+    preview->m_header->magic.store(MAGIC, std::memory_order_release);
+    return preview;
+}
+
+std::unique_ptr<Preview> Preview::open(const std::string &name) {
+    const int fd = shm_open(segment(name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(PreviewHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    std::unique_ptr<Preview> preview(new Preview());
+    preview->m_data = data;
+    preview->m_size = st.st_size;
+    preview->m_header = static_cast<PreviewHeader*>(data);
+    const PreviewHeader &h = *preview->m_header;
+    if (h.magic.load(std::memory_order_acquire) != MAGIC || h.version != VERSION || !h.width || !h.height || !h.block)
+        return nullptr;
+    // the layout create() makes, anything else would read past the mapping
+    const uint64_t columns = (uint64_t(h.width) + h.block - 1) / h.block;
+    const uint64_t rows = (uint64_t(h.height) + h.block - 1) / h.block;
+    if (h.columns != columns || h.rows != rows || h.pixelOffset % alignof(Vec3)
+        || sizeof(PreviewHeader) + columns * rows * sizeof(uint32_t) > h.pixelOffset
+        || h.pixelOffset + uint64_t(h.width) * h.height * sizeof(Vec3) > preview->m_size)
+        return nullptr;
+    preview->m_sequence = reinterpret_cast<std::atomic<uint32_t>*>(static_cast<char*>(data) + sizeof(PreviewHeader));
+    preview->m_pixels = reinterpret_cast<Vec3*>(static_cast<char*>(data) + h.pixelOffset);
+    return preview;
+}
+
+uint32_t Preview::read(uint32_t i, Vec3 *image) const {
+    const PreviewHeader &h = *m_header;
+    const int x = (i % h.columns) * h.block;
+    const int y = (i / h.columns) * h.block;
+    const int w = std::min<int>(h.block, h.width - x);
+    const int rows = std::min<int>(h.block, h.height - y);
+    while (true) {
+        const uint32_t before = m_sequence[i].load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (int r = 0; r < rows; r++)
+            memcpy(&image[size_t(y + r) * h.width + x], &m_pixels[size_t(y + r) * h.width + x], w * sizeof(Vec3));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence[i].load(std::memory_order_relaxed) == before)
+            return before / 2;
+    }
+}
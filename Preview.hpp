@@ -0,0 +1,94 @@
+#pragma once
+#include "Vector.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+/*
+    Headless live preview: the tone mapped frame in a POSIX shared memory
+    segment that the renderer draws its tiles into directly, so viewers and
+    monitoring tools can map it and follow the render without copies, locks
+    or a GPU. Layout of the segment:
+      PreviewHeader
+      columns * rows uint32_t tile sequence numbers, row major
+      at pixelOffset: width * height pixels of 3 floats, row major
+    Tile (i, j) covers the pixels [j*block, (j+1)*block) x [i*block, (i+1)*block)
+    clipped to the frame. A tile's sequence number is odd while the renderer
+    writes to it and goes up by two with every update, a reader copies a tile
+    and keeps the copy if the number was even and unchanged around it.
+*/
+struct PreviewHeader {
+    std::atomic<uint32_t> magic; // "RTPV", set last
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t block;
+    uint32_t columns, rows;
+    uint32_t pixelOffset; // from the start of the segment
+    std::atomic<uint64_t> progress; // tiles rendered so far
+    std::atomic<uint32_t> done;     // 1 once the frame is final
+    uint32_t pid;         // of the renderer
+};
+
+class Preview {
+public:
+    ~Preview();
+
+    /*
+        Creates the segment /name for a width x height frame in tiles of block,
+        replacing an old one, and unlinks it again when destroyed; viewers that
+        still have it mapped keep reading the last frame.
+        Prints the reason and returns nullptr on failure.
+    */
+    static std::unique_ptr<Preview> create(const std::string &name, int width, int height, int block);
+
+    // maps an existing segment read only, nullptr if there is none or its header doesn't describe a preview that fits it
+    static std::unique_ptr<Preview> open(const std::string &name);
+
+    inline const PreviewHeader &header() const { return *m_header; }
+    inline uint32_t tiles() const { return m_header->columns * m_header->rows; }
+    inline Vec3 *pixels() { return m_pixels; }
+
+    // calls write() to update the pixels of the tile at (x, y) and counts it as rendered
+    template <typename F>
+    void tile(int x, int y, F &&write) {
+        std::atomic<uint32_t> &sequence = m_sequence[(y / m_header->block) * m_header->columns + x / m_header->block];
+        const uint32_t s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write();
+        sequence.store(s + 2, std::memory_order_release);
+        m_header->progress.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // calls write() to replace the whole frame, e.g. with the denoised one
+    template <typename F>
+    void frame(F &&write) {
+        for (uint32_t i = 0; i < tiles(); i++)
+            m_sequence[i].fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write();
+        for (uint32_t i = 0; i < tiles(); i++)
+            m_sequence[i].fetch_add(1, std::memory_order_release);
+    }
+
+    inline void finish() { m_header->done.store(1, std::memory_order_release); }
+
+    /*
+        Viewers: copies tile i to the same place in image (a width x height
+        frame) once it is not being written, returns how often it was
+        updated, 0 if it was never rendered.
+    */
+    uint32_t read(uint32_t i, Vec3 *image) const;
+
+private:
+    Preview() = default;
+
+    std::string m_name;
+    bool m_owner{ false };
+    void *m_data{ nullptr };
+    size_t m_size{ 0 };
+    PreviewHeader *m_header{ nullptr };
+    std::atomic<uint32_t> *m_sequence{ nullptr };
+    Vec3 *m_pixels{ nullptr };
+};
@@ -3,116 +3,836 @@
 #include "Vector.hpp"
 #include "Ray.hpp"
 #include "Integrator.hpp"
+#include "Wavefront.hpp"
+#include "Scene.hpp"
+#include "JobList.hpp"
+#include "Adaptive.hpp"
 #include "Color.hpp"
+#include "MappedFile.hpp"
+#include "Output.hpp"
+#include "Checkpoint.hpp"
+#include "Distributed.hpp"
+#include "Server.hpp"
+#include "Preview.hpp"
+#include "Guiding.hpp"
+#include "Animation.hpp"
+#include "Stats.hpp"
+#include "Camera.hpp"
+#include "Scenes.hpp"
+#include "Denoise.hpp"
 #include <thread>
+#include <shared_mutex>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
 #include <algorithm>
-#include <mutex>
 #include <cstring>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <unistd.h>
+#include <sys/wait.h>
+
 // #define USEGL
 #ifdef USEGL
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #endif
 
-constexpr int THREADS = 12;
-constexpr int BLOCK = 32;
-std::vector<Sphere> spheres;
-std::vector<Plane> planes;
-std::vector<const Object*> objects;
+Scene scene;
+bool wavefront = false;
+Sampler::Type samplerType = Sampler::SOBOL;
+uint32_t seed = 0;
+AdaptiveSettings adaptive;
+uint32_t Samples = N;
+uint32_t PrimaryRays = 0;         // first hits cached per pixel, 0 traces every camera ray, see trace_gbuffer()
+std::vector<PixelEstimate> Accum; // linear accumulation buffer, what a checkpoint stores
+std::shared_mutex AccumLock;      // tiles are committed shared, a checkpoint copies Accum exclusively
+std::atomic<bool> Stop{ false };  // set on SIGINT/SIGTERM, threads finish their tile and quit
+#ifdef RT_STATS
+std::vector<uint64_t> Cost;       // traversal work per pixel, see Stats::work
+#endif
+std::vector<Vec3> Linear; // the unmapped mean of every pixel
+bool denoising = false;   // outputs wait for the whole frame, see denoise()
+std::vector<std::unique_ptr<ImageOutput>> Outputs;
+std::unique_ptr<Preview> LivePreview; // holds the tone mapped image when given --preview
+std::unique_ptr<Guide> PathGuide;     // learned distributions of the incoming light when given --guide
+uint32_t TrainingSamples = 0;         // while the guide trains, the samples per pixel of the pass so far
 
-struct Task {
-    int x, y;
-    int w, h;
-    Vec3* image;
+const Camera camera(W, H);
 
-    Task() = default;
-    Task(int x, int y, int w, int h, Vec3* image) : x(x), y(y), w(w), h(h), image(image) {}
-    Task(const Task &t) : x(t.x), y(t.y), w(t.w), h(t.h), image(t.image) {}
+// per thread scratch space of render_tile
+struct TileContext {
+    Wavefront paths;
+    std::vector<PixelEstimate> estimates;
+    std::vector<Float> error;
+    std::vector<uint32_t> active; // tile local pixel indices still taking samples
+    std::vector<PrimaryHit> gbuffer; // PrimaryRays per pixel, empty for exact camera rays
+#ifdef RT_STATS
+    std::vector<uint64_t> cost;
+#endif
 };
 
+// takes every active pixel of the tile up to target samples through view, returns the number of samples taken
+uint64_t trace_samples(const Task *task, TileContext &ctx, uint32_t target, const Camera &view, Sampler sampler) {
+    uint64_t taken = 0;
+    for (uint32_t p : ctx.active) {
+        const int x = task->x + p % task->w;
+        const int y = task->y + p / task->w;
+        const uint32_t first = ctx.estimates[p].count;
+        taken += std::max(first, target) - first;
+        STAT(threadStats.pixel(p));
+        for (uint32_t n = first; n < target; n++) {
+            sampler.start(y * view.width + x, n);
+            if (!ctx.gbuffer.empty()) {
+                // the camera dimensions stay drawn so the bounces see the same samples as with exact rays
+                sampler.get2D();
+                const PrimaryHit &hit = ctx.gbuffer[size_t(p) * PrimaryRays + n % PrimaryRays];
+                if (wavefront)
+                    ctx.paths.add(hit, p, sampler);
+                else {
+                    Features firstHit;
+                    const Vec3 L = Li(scene, hit.ray, sampler, &firstHit, BOUNCES, &hit, PathGuide.get());
+                    ctx.estimates[p].add(L, firstHit);
+                }
+                continue;
+            }
+            const Ray ray = view.ray(x, y, sampler);
+            if (wavefront)
+                ctx.paths.add(ray, p, sampler);
+            else {
+                Features firstHit;
+                const Vec3 L = Li(scene, ray, sampler, &firstHit, BOUNCES, nullptr, PathGuide.get());
+                ctx.estimates[p].add(L, firstHit);
+            }
+        }
+    }
+    if (wavefront)
+        ctx.paths.trace(scene, ctx.estimates.data());
+    return taken;
+}
+
+/*
+    Traces the G-buffer of a tile: the first hits of the camera rays of the
+    first PrimaryRays samples of every pixel. Sample n of a pixel continues
+    from the hit of sample n % PrimaryRays, so with the Sobol sampler and a
+    power of 4 every cached ray stands for its own stratum of the pixel.
+*/
+void trace_gbuffer(const Task *task, TileContext &ctx) {
+    Sampler sampler(samplerType, seed);
+    ctx.gbuffer.clear();
+    for (int p = 0; p < task->w * task->h; p++) {
+        const int x = task->x + p % task->w;
+        const int y = task->y + p / task->w;
+        STAT(threadStats.pixel(p));
+        for (uint32_t n = 0; n < PrimaryRays; n++) {
+            sampler.start(y * W + x, n);
+            ctx.gbuffer.emplace_back(scene, camera.ray(x, y, sampler));
+        }
+    }
+}
 
-struct JobList {
-    std::vector<Task> tasks;
+// stores the finished estimates of a tile in Accum and writes its pixels to the image buffers and outputs
+void commit_tile(const Task *task, const PixelEstimate *estimates) {
+    auto write = [&]() {
+        std::shared_lock lock(AccumLock);
+        for (int p = 0; p < task->w * task->h; p++) {
+            const int j = p % task->w;
+            const int i = p / task->w;
+            const Vec3 mean = estimates[p].mean();
+            task->image[i*W + j] = ACESFilm(mean);
+            Linear[(i + task->y) * W + j + task->x] = mean;
+            Accum[(i + task->y) * W + j + task->x] = estimates[p];
+        }
+    };
+    if (LivePreview)
+        LivePreview->tile(task->x, task->y, write);
+    else
+        write();
+
+    // training passes leave the tile unfinished, the render revisits it
+    if (denoising || TrainingSamples)
+        return;
+    for (const std::unique_ptr<ImageOutput> &output : Outputs)
+        output->tile(task->x, task->y, task->w, task->h);
+}
 
-    Task* getTask() {
-        static const uint64_t taskCount = tasks.size();
-        lock.lock();
-        uint64_t n = index++;
-        lock.unlock();
-        if (n >= taskCount)
-            return nullptr;
-        return &tasks[n];
+// continues the tile from its pixels in Accum, which are not zero when resuming a checkpoint
+void render_tile(Task *task, TileContext &ctx) {
+    const uint32_t pixels = task->w * task->h;
+    ctx.estimates.resize(pixels);
+    ctx.error.resize(pixels);
+    ctx.active.resize(pixels);
+    uint64_t spent = 0;
+    for (uint32_t p = 0; p < pixels; p++) {
+        ctx.estimates[p] = Accum[(task->y + p / task->w) * W + task->x + p % task->w];
+        ctx.active[p] = p;
+        spent += ctx.estimates[p].count;
     }
+#ifdef RT_STATS
+    ctx.cost.assign(pixels, 0);
+    threadStats.begin(ctx.cost.data());
+#endif
+    if (PrimaryRays)
+        trace_gbuffer(task, ctx);
 
-    constexpr uint64_t getProgress() const { return index; }
-    
-private:
-    std::mutex lock;
-    uint64_t index{ 0 };
-};
+    if (TrainingSamples) {
+        trace_samples(task, ctx, TrainingSamples, camera, Sampler(samplerType, seed));
+    }
+    else if (adaptive.threshold <= 0) {
+        trace_samples(task, ctx, Samples, camera, Sampler(samplerType, seed));
+    }
+    else {
+        uint64_t budget = uint64_t(Samples) * pixels - std::min<uint64_t>(spent, uint64_t(Samples) * pixels);
+        uint32_t target = std::min(adaptive.minSamples, Samples);
+        while (true) {
+            budget -= std::min(budget, trace_samples(task, ctx, target, camera, Sampler(samplerType, seed)));
+
+            // a pixel only stops once its 3x3 neighbourhood in the tile looks converged,
+            // a single pixel's estimate of its own variance is too noisy at low counts
+            for (uint32_t p = 0; p < pixels; p++)
+                ctx.error[p] = ctx.estimates[p].error();
+            std::erase_if(ctx.active, [&](uint32_t p) {
+                const int x = p % task->w, y = p / task->w;
+                Float e = 0;
+                for (int i = std::max(y-1, 0); i <= std::min(y+1, task->h-1); i++) {
+                    for (int j = std::max(x-1, 0); j <= std::min(x+1, task->w-1); j++)
+                        e = std::max(e, ctx.error[i*task->w + j]);
+                }
+                return e <= adaptive.threshold;
+            });
+            if (ctx.active.empty())
+                break;
+
+            // the active pixels double their samples while the budget lasts
+            const uint32_t next = std::min<uint64_t>({ uint64_t(target) * 2, adaptive.maxSamples, target + budget / ctx.active.size() });
+            if (next <= target)
+                break;
+            target = next;
+        }
+    }
 
-void render_thread(JobList* joblist)
+#ifdef RT_STATS
+    threadStats.end();
+    for (uint32_t p = 0; p < pixels; p++)
+        Cost[(task->y + p / task->w) * W + task->x + p % task->w] = ctx.cost[p];
+#endif
+    commit_tile(task, ctx.estimates.data());
+}
+
+void render_thread(JobList* joblist, int worker)
 {
-    static const Float Inv_N = 1.0 / N;
-    static const Float inv_pixel_size = 1.0 / sqrt(Float(W)*W + Float(H)*H);
-    static const Vec3 P(0, 0, -0.5);
-    while (Task *task = joblist->getTask())
-    {
-        for (int i=0; i < task->h; i++) {
-            for (int j=0; j < task->w; j++) {
-                Vec3 &pixel = task->image[i*W + j];
-                for (int n=0; n < N; n++) {
-                    const Vec3 receiver((j + task->x - W*0.5+0.5)/H, (H*0.5- i - task->y - 0.5)/H, 0);
-                    const Vec3 dir = (receiver-P).normalize();
-                    const Vec3 h = dir + random_hemi_vector(dir) * inv_pixel_size;
-                    const Ray ray = Ray::NormalizedRay(P, h);
-                    pixel += Li(objects, ray);
+    TileContext ctx;
+    while (!Stop) {
+        Task *task = joblist->getTask(worker);
+        if (!task)
+            break;
+        STAT(auto start = std::chrono::steady_clock::now());
+        render_tile(task, ctx);
+        STAT(threadStats.tiles.push_back({ task->x, task->y, task->w, task->h, worker,
+                                           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() }));
+    }
+}
+
+// a tile of a render server job at a fixed sample count, the linear means go to pixels
+void render_job_tile(const RenderJob &job, const Task &task, TileContext &ctx, Vec3 *pixels) {
+    const uint32_t count = task.w * task.h;
+    ctx.estimates.assign(count, PixelEstimate());
+    ctx.gbuffer.clear();
+    ctx.active.resize(count);
+    for (uint32_t p = 0; p < count; p++)
+        ctx.active[p] = p;
+    trace_samples(&task, ctx, job.samples, Camera(job.width, job.height, job.camera), Sampler(Sampler::Type(job.sampler), job.seed));
+    for (uint32_t p = 0; p < count; p++)
+        pixels[p] = ctx.estimates[p].mean();
+}
+
+// snapshot of Accum, consistent per tile
+Checkpoint checkpoint(uint64_t key) {
+    Checkpoint c;
+    c.key = key;
+    c.seed = seed;
+    c.sampler = samplerType;
+    c.width = W;
+    c.height = H;
+    std::unique_lock lock(AccumLock);
+    c.pixels = Accum;
+    return c;
+}
+
+// path of one frame of a sequence: a run of # in path becomes the zero padded frame number, else it goes before the extension
+std::string frame_path(std::string path, uint32_t frame) {
+    const size_t name = path.find_last_of('/') + 1; // 0 without a directory
+    size_t first = path.find('#', name);
+    if (first == std::string::npos) {
+        const size_t dot = path.find_last_of('.');
+        first = dot != std::string::npos && dot > name ? dot : path.size();
+        path.insert(first++, ".####");
+    }
+    const size_t count = std::min(path.find_first_not_of('#', first), path.size()) - first;
+    std::string number = std::to_string(frame);
+    if (number.size() < count)
+        number.insert(0, count - number.size(), '0');
+    return path.replace(first, count, number);
+}
+
+int main(int argc, char **argv) {
+    int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    int block = 32;
+    bool pin = false;
+    std::vector<std::string> meshes;
+    std::vector<std::pair<std::string, int>> instanced; // asset file, number of instances
+    std::string cachePath;
+    std::string checkpointPath;
+    double checkpointInterval = 600; // seconds
+    std::string serveAddress, connectAddress;
+    std::string daemonAddress, submitAddress;
+    std::string previewName, watchName;
+    int frame[2] = { W, H };
+    int region[4] = { 0, 0, -1, -1 }; // x, y, w, h, the whole frame if w < 0
+    Vec3 eye(0, 0, -0.5), look(0, 0, 0);
+    std::string statsPath, heatmapPath, sampleMapPath;
+    std::string albedoPath, normalPath, depthPath;
+    DenoiseSettings denoiseSettings;
+    int spawn = 0;
+    int guidePasses = 0;
+    std::string animationPath;
+    int frames = 0;       // of the sequence, 0 up to the last key
+    bool rebuild = false; // the sequence builds a new BVH for every frame instead of refitting
+    bool lights = false;
+    std::vector<std::string> outputs, linearOutputs;
+    ImageOutput::Mode outputMode = ImageOutput::PWRITE;
+    ImageOutput::Compression compression = ImageOutput::RLE;
+
+    for (int i=1; i < argc; i++) {
+        if (!strcmp(argv[i], "--wavefront")) {
+            wavefront = true;
+        }
+        else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+            threadCount = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--block") && i+1 < argc) {
+            block = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--pin")) {
+            pin = true;
+        }
+        else if (!strcmp(argv[i], "--mesh") && i+1 < argc) {
+            meshes.emplace_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--instances") && i+2 < argc) {
+            instanced.emplace_back(argv[i+1], std::max(1, atoi(argv[i+2])));
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "--bvh") && i+1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "wide"))
+                scene.wide = true;
+            else if (strcmp(argv[i], "binary")) {
+                std::cerr << "unknown BVH layout " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--lights")) {
+            lights = true;
+        }
+        else if (!strcmp(argv[i], "--cache") && i+1 < argc) {
+            cachePath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--samples") && i+1 < argc) {
+            Samples = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--primary-cache") && i+1 < argc) {
+            PrimaryRays = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--checkpoint") && i+1 < argc) {
+            checkpointPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--stats") && i+1 < argc) {
+            statsPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--heatmap") && i+1 < argc) {
+            heatmapPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--denoise")) {
+            denoising = true;
+        }
+        else if (!strcmp(argv[i], "--denoise-iterations") && i+1 < argc) {
+            denoiseSettings.iterations = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--albedo") && i+1 < argc) {
+            albedoPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--normals") && i+1 < argc) {
+            normalPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--depth") && i+1 < argc) {
+            depthPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--serve") && i+1 < argc) {
+            serveAddress = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--spawn") && i+1 < argc) {
+            spawn = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--connect") && i+1 < argc) {
+            connectAddress = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--preview") && i+1 < argc) {
+            previewName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--watch") && i+1 < argc) {
+            watchName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--guide") && i+1 < argc) {
+            guidePasses = std::clamp(atoi(argv[++i]), 0, 16);
+        }
+        else if (!strcmp(argv[i], "--animate") && i+1 < argc) {
+            animationPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--frames") && i+1 < argc) {
+            frames = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--rebuild")) {
+            rebuild = true;
+        }
+        else if (!strcmp(argv[i], "--daemon") && i+1 < argc) {
+            daemonAddress = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--submit") && i+1 < argc) {
+            submitAddress = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--size") && i+2 < argc) {
+            for (int k = 0; k < 2; k++)
+                frame[k] = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--region") && i+4 < argc) {
+            for (int k = 0; k < 4; k++)
+                region[k] = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--eye") && i+3 < argc) {
+            eye = Vec3(atof(argv[i+1]), atof(argv[i+2]), atof(argv[i+3]));
+            i += 3;
+        }
+        else if (!strcmp(argv[i], "--look") && i+3 < argc) {
+            look = Vec3(atof(argv[i+1]), atof(argv[i+2]), atof(argv[i+3]));
+            i += 3;
+        }
+        else if (!strcmp(argv[i], "--checkpoint-interval") && i+1 < argc) {
+            checkpointInterval = std::max(1.0, atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--output") && i+1 < argc) {
+            outputs.emplace_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--linear") && i+1 < argc) {
+            linearOutputs.emplace_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--stream")) {
+            outputMode = ImageOutput::STREAM;
+        }
+        else if (!strcmp(argv[i], "--exr") && i+1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "none"))
+                compression = ImageOutput::NONE;
+            else if (!strcmp(argv[i], "rle"))
+                compression = ImageOutput::RLE;
+            else {
+                std::cerr << "unknown EXR compression " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--adaptive") && i+1 < argc) {
+            adaptive.threshold = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--min-samples") && i+1 < argc) {
+            adaptive.minSamples = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--max-samples") && i+1 < argc) {
+            adaptive.maxSamples = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--sample-map") && i+1 < argc) {
+            sampleMapPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--seed") && i+1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--sampler") && i+1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "random"))
+                samplerType = Sampler::RANDOM;
+            else if (!strcmp(argv[i], "sobol"))
+                samplerType = Sampler::SOBOL;
+            else {
+                std::cerr << "unknown sampler " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--wavefront] [--threads N] [--block N] [--pin] [--samples N] [--seed S] [--sampler sobol|random] [--adaptive threshold [--min-samples N] [--max-samples N] [--sample-map file]] [--primary-cache rays] [--guide passes] [--animate keys.txt [--frames N] [--rebuild]] [--mesh file.obj|file.ply]... [--instances file.obj|file.ply count]... [--lights] [--bvh binary|wide] [--cache file] [--checkpoint file] [--checkpoint-interval seconds] [--serve address [--spawn K] | --connect address] [--daemon address] [--submit address [--size W H] [--region x y w h] [--eye x y z] [--look x y z]] [--preview name] [--watch name] [--output file.ppm|.pfm|.exr]... [--linear file.pfm|.exr|.ppm]... [--stream] [--exr none|rle] [--stats file.json] [--heatmap file] [--denoise [--denoise-iterations N]] [--albedo file] [--normals file] [--depth file]\n";
+            return 1;
+        }
+    }
+    if (adaptive.minSamples == 0 || adaptive.minSamples > adaptive.maxSamples) {
+        std::cerr << "--min-samples has to be at least 1 and at most --max-samples\n";
+        return 1;
+    }
+
+    // follows the preview of another render until its frame is final, then writes it to the outputs
+    if (!watchName.empty()) {
+        std::unique_ptr<Preview> preview;
+        for (int attempt = 0; attempt < 100 && !(preview = Preview::open(watchName)); attempt++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!preview) {
+            std::cerr << watchName << ": no preview\n";
+            return 1;
+        }
+        const PreviewHeader &header = preview->header();
+        const int width = header.width, height = header.height;
+        std::cout << watchName << ": " << width << "x" << height << " in " << preview->tiles() << " tiles, renderer " << header.pid << "\n";
+        bool alive = true;
+        while (!header.done.load(std::memory_order_acquire) && (alive = kill(header.pid, 0) == 0)) {
+            std::cout << "\r" << header.progress.load(std::memory_order_relaxed) << "/" << preview->tiles() << " tiles" << std::flush;
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+        std::cout << "\r" << header.progress.load(std::memory_order_relaxed) << "/" << preview->tiles() << " tiles, "
+                  << (alive ? "done" : "renderer exited") << "\n";
+
+        std::vector<Vec3> frame(size_t(width) * height);
+        for (uint32_t i = 0; i < preview->tiles(); i++)
+            preview->read(i, frame.data());
+        bool written = true;
+        for (const std::string &path : outputs) {
+            std::unique_ptr<ImageOutput> output = ImageOutput::open(path, frame.data(), width, height, height);
+            if (output)
+                output->tile(0, 0, width, height);
+            written &= output && output->finish();
+        }
+        return written && alive ? 0 : 1;
+    }
+
+    // a client of a render server needs no scene, it writes the region it gets back
+    if (!submitAddress.empty()) {
+        if (region[2] < 0) {
+            region[2] = frame[0];
+            region[3] = frame[1];
+        }
+        if (region[2] <= 0 || region[3] <= 0) {
+            std::cerr << "empty region\n";
+            return 1;
+        }
+        const RenderJob job{ 1, uint32_t(frame[0]), uint32_t(frame[1]), region[0], region[1], region[2], region[3],
+                             uint32_t(block), Samples, seed, uint32_t(samplerType), Camera::look_at(eye, look) };
+        std::vector<Vec3> tonemapped(size_t(region[2]) * region[3]), linear(tonemapped.size());
+        if (outputs.empty() && linearOutputs.empty())
+            outputs.emplace_back("render.ppm");
+        for (const std::string &path : outputs)
+            Outputs.push_back(ImageOutput::open(path, tonemapped.data(), region[2], region[3], block, outputMode, compression));
+        for (const std::string &path : linearOutputs)
+            Outputs.push_back(ImageOutput::open(path, linear.data(), region[2], region[3], block, outputMode, compression));
+        if (std::find(Outputs.begin(), Outputs.end(), nullptr) != Outputs.end())
+            return 1;
+
+        auto s1 = std::chrono::high_resolution_clock::now();
+        double firstTile = -1;
+        const bool ok = submit(submitAddress, job, [&](const Task &task, const Vec3 *pixels) {
+            if (firstTile < 0)
+                firstTile = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - s1).count();
+            for (int i = 0; i < task.h; i++) {
+                for (int j = 0; j < task.w; j++) {
+                    const size_t p = size_t(task.y + i) * region[2] + task.x + j;
+                    linear[p] = pixels[i * task.w + j];
+                    tonemapped[p] = ACESFilm(linear[p]);
                 }
-                pixel = ACESFilm(pixel * Inv_N);
             }
+            for (const std::unique_ptr<ImageOutput> &output : Outputs)
+                output->tile(task.x, task.y, task.w, task.h);
+        });
+        bool written = ok;
+        for (const std::unique_ptr<ImageOutput> &output : Outputs)
+            written &= output->finish();
+        auto s2 = std::chrono::high_resolution_clock::now();
+        if (ok)
+            std::cout << "first tile after " << firstTile << "ms, " << std::chrono::duration<double, std::milli>(s2 - s1).count() << "ms in total\n";
+        return written ? 0 : 1;
+    }
+
+    Animation animation;
+    if (!animationPath.empty()) {
+        if (!serveAddress.empty() || !connectAddress.empty() || !daemonAddress.empty() || !checkpointPath.empty()
+            || !previewName.empty() || denoising || guidePasses) {
+            std::cerr << "--animate renders in a single process without --serve, --connect, --daemon, --checkpoint, --preview, --denoise or --guide\n";
+            return 1;
+        }
+        if (!animation.load(animationPath))
+            return 1;
+        if (!cachePath.empty()) {
+            std::cerr << "--cache doesn't keep the sphere order --animate needs, ignored\n";
+            cachePath.clear();
         }
+        if (!frames)
+            frames = std::max(1u, animation.frames());
+    }
+
+    Sampler rng(Sampler::RANDOM, seed);
+    rng.start(W*H, 0);
+    spheres_scene(scene, rng);
+    if (lights)
+        add_lights(scene);
+    const uint32_t meshMaterial = scene.addMaterial(DIFFUSE_WHITE);
+    const uint32_t instanceMaterial = scene.addMaterial(DIELECTRIC_GOLD);
+
+    // the generated primitives and the mesh files decide if the cache and a checkpoint are still valid
+    bool cached = false;
+    uint64_t key = 0;
+    if (!cachePath.empty() || !checkpointPath.empty() || !serveAddress.empty() || !connectAddress.empty()) {
+        auto c1 = std::chrono::high_resolution_clock::now();
+        key = scene.hash();
+        for (const std::string &path : meshes) {
+            if (!hash_file(path, key)) {
+                std::cerr << path << ": can't read file\n";
+                return 1;
+            }
+        }
+        for (const auto &[path, count] : instanced) {
+            if (!hash_file(path, key)) {
+                std::cerr << path << ": can't read file\n";
+                return 1;
+            }
+            key = hash_bytes(&count, sizeof(count), key);
+        }
+        cached = !cachePath.empty() && scene.load(cachePath, key);
+        auto c2 = std::chrono::high_resolution_clock::now();
+        if (cached)
+            std::cout << "scene cache: loaded " << cachePath << " in " << std::chrono::duration<double, std::milli>(c2 - c1).count() << "ms\n";
+    }
+
+    std::vector<Animation::Part> parts; // where every --mesh went in scene.mesh
+    if (!cached) {
+        for (const std::string &path : meshes) {
+            auto m1 = std::chrono::high_resolution_clock::now();
+            Mesh part;
+            if (!load_mesh(path, part, threadCount))
+                return 1;
+            const size_t bytes = scene.mesh.bytes();
+            parts.push_back({ uint32_t(scene.mesh.vertices.size()), uint32_t(part.vertices.size()) });
+            scene.mesh.append(part, meshMaterial);
+            auto m2 = std::chrono::high_resolution_clock::now();
+            std::cout << path << ": " << part.triangles() << " triangles, "
+                      << std::chrono::duration<double, std::milli>(m2 - m1).count() << "ms, "
+                      << double(scene.mesh.bytes() - bytes) / std::max<size_t>(1, part.triangles()) << " bytes/triangle\n";
+        }
+        for (const auto &[path, count] : instanced) {
+            Mesh asset;
+            if (!load_mesh(path, asset, threadCount))
+                return 1;
+            if (!asset.triangles()) {
+                std::cerr << path << ": no triangles to instance\n";
+                return 1;
+            }
+            add_instances(scene, rng, asset, meshMaterial, instanceMaterial, count);
+            std::cout << path << ": " << count << " instances of " << asset.triangles() << " triangles, "
+                      << asset.bytes() << " bytes shared, " << sizeof(Instance) << " bytes/instance\n";
+        }
+
+        // the first frame of a sequence is built in its pose, the others are refit
+        if (!animationPath.empty()) {
+            if (!animation.bind(scene, parts))
+                return 1;
+            animation.apply(scene, 0);
+        }
+        scene.build();
+        const size_t primitives = std::max<size_t>(1, scene.spheres.size() + scene.triangles.size() + scene.mesh.triangles() + scene.instances.size());
+        std::cout << "BVH: " << scene.bvh().nodes.size() << " nodes, " << scene.bvh().buildTime << "ms, "
+                  << double(scene.bvh().nodes.size() * sizeof(BVHNode)) / primitives << " bytes/primitive, wide: "
+                  << scene.wideBVH().nodes.size() << " nodes, " << double(scene.wideBVH().bytes()) / primitives << " bytes/primitive\n";
+
+        if (!cachePath.empty() && scene.save(cachePath, key))
+            std::cout << "scene cache: wrote " << cachePath << "\n";
     }
-}
 
-int main() {
-    planes.emplace_back(Vec3(0, 1, 0), -1, &GROUND);
-
-    //*
-    for (int i=0; i < 100; i++) {
-        Vec3 u(0,-1,0);
-        while (u.y < 0)
-            u = random_unit_vector();
-        
-        bool diffuse = (UniRand() < 0.5);
-        spheres.emplace_back(
-            Vec3(0,0,4) + u * 3, UniRand()*0.25 + 0.25,
-            diffuse ? static_cast<const BxDF*>(&DIELECTRIC_WHITE) : static_cast<const BxDF*>(&DIELECTRIC_GOLD)
-        );
-    }
-    /*/
-    spheres.emplace_back(Vec3(0,0,3), 1, &DIELECTRIC_GOLD);
-    //*/
-
-    for (const Sphere& obj : spheres)
-        objects.emplace_back(&obj);
-    for (const Plane& obj : planes)
-        objects.emplace_back(&obj);
-
-    std::vector<Vec3> Pixels(W*H);
+    // the scene stays loaded, every job renders on the same pool of threads
+    if (!daemonAddress.empty()) {
+        std::signal(SIGINT, [](int) { Stop = true; });
+        std::signal(SIGTERM, [](int) { Stop = true; });
+        std::vector<TileContext> contexts(threadCount);
+        const bool ok = serve(daemonAddress, threadCount, [&](const RenderJob &job, const Task &task, int thread, Vec3 *pixels) {
+            render_job_tile(job, task, contexts[thread], pixels);
+        }, Stop);
+        return ok ? 0 : 1;
+    }
+
+    if (guidePasses && (wavefront || !serveAddress.empty() || !connectAddress.empty())) {
+        std::cerr << "--guide needs a single process without --wavefront, ignored\n";
+        guidePasses = 0;
+    }
+    if (guidePasses)
+        PathGuide = std::make_unique<Guide>(scene.bvh().empty() ? AABB() : scene.bvh().nodes[0].bounds);
+
+    Accum.assign(W*H, PixelEstimate());
+    if (!checkpointPath.empty()) {
+        Checkpoint resume;
+        if (resume.load(checkpointPath)) {
+            if (resume.key != key || resume.seed != seed || resume.sampler != uint32_t(samplerType) || resume.width != W || resume.height != H) {
+                std::cerr << checkpointPath << ": checkpoint of a different scene, seed, sampler or resolution\n";
+                return 1;
+            }
+            Accum.swap(resume.pixels);
+            uint64_t total = 0;
+            for (const PixelEstimate &e : Accum)
+                total += e.count;
+            std::cout << "checkpoint: resuming " << checkpointPath << " at " << double(total) / (W*H) << " spp\n";
+        }
+    }
+
+#ifdef RT_STATS
+    Cost.assign(W*H, 0);
+#else
+    if (!statsPath.empty() || !heatmapPath.empty())
+        std::cerr << "built without RT_STATS, --stats and --heatmap are ignored\n";
+#endif
+
+    // with a preview the tiles are drawn straight into the shared memory, workers have none
+    std::vector<Vec3> Pixels;
+    if (!previewName.empty() && connectAddress.empty()) {
+        LivePreview = Preview::create(previewName, W, H, block);
+        if (!LivePreview)
+            return 1;
+    }
+    else
+        Pixels.resize(W*H);
+    Vec3 * const image = LivePreview ? LivePreview->pixels() : Pixels.data();
+    Linear.assign(W*H, Vec3(0));
     JobList jobs;
+    jobs.build(W, H, block, image);
 
-    for (int i=0; i < H; i += BLOCK) {
-        for (int j=0; j < W; j += BLOCK) {
-            int w = BLOCK, h = BLOCK;
-            if (i+w >= W)
-                w = W-i;
-            if (i+h >= H)
-                h = H-i;
-            jobs.tasks.emplace_back(j, i, w, h, &Pixels[i*W+j]);
+    // everything a coordinator and its workers have to agree on
+    const struct {
+        uint64_t key;
+        uint32_t seed, sampler, samples, width, height, primaryRays;
+        AdaptiveSettings adaptive;
+    } settings{ key, seed, uint32_t(samplerType), Samples, uint32_t(W), uint32_t(H), PrimaryRays, adaptive };
+    const uint64_t settingsHash = hash_bytes(&settings, sizeof(settings));
+
+    if (!connectAddress.empty()) {
+        std::vector<TileContext> contexts(threadCount);
+        const bool ok = work(connectAddress, settingsHash, threadCount, Accum.data(), W, H, [&](Task &task, int thread) {
+            task.image = &image[task.y * W + task.x];
+            render_tile(&task, contexts[thread]);
+        });
+        return ok ? 0 : 1;
+    }
+
+    // first, if given, runs on the first thread before it takes tiles
+    std::vector<std::thread> threads(threadCount);
+    auto spawn_threads = [&](const std::function<void()> &first = nullptr) {
+        for (int thr=0; thr < threadCount; thr++) {
+            if (thr == 0 && first) {
+                threads[thr] = std::thread([&jobs, first]() {
+                    first();
+                    render_thread(&jobs, 0);
+                });
+            }
+            else
+                threads[thr] = std::thread(render_thread, &jobs, thr);
+            #ifdef __linux__
+            if (pin) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(thr % std::thread::hardware_concurrency(), &cpus);
+                pthread_setaffinity_np(threads[thr].native_handle(), sizeof(cpus), &cpus);
+            }
+            #endif
+        }
+    };
+
+    /*
+        Sequence: between frames the keyed objects move and the BVH is refit
+        around them, or rebuilt with --rebuild. Frames take turns in two
+        buffers, the first thread encodes and writes the files of a frame
+        while the others already render the next one.
+    */
+    if (!animationPath.empty()) {
+        std::signal(SIGINT, [](int) { Stop = true; });
+        std::signal(SIGTERM, [](int) { Stop = true; });
+        if (outputs.empty() && linearOutputs.empty())
+            outputs.emplace_back("render_####.ppm");
+        std::vector<Vec3> images[2] = { std::vector<Vec3>(W*H), std::vector<Vec3>(W*H) };
+        std::vector<Vec3> linears[2] = { std::vector<Vec3>(W*H), std::vector<Vec3>(W*H) };
+        bool written = true;
+        double outputTime = 0;
+        // the files of frame f from buffer b, as a single band
+        auto write_frame = [&](uint32_t f, int b) {
+            const auto o1 = std::chrono::high_resolution_clock::now();
+            auto write = [&](const std::string &path, const Vec3 *pixels) {
+                std::unique_ptr<ImageOutput> output = ImageOutput::open(frame_path(path, f), pixels, W, H, H, outputMode, compression);
+                if (output)
+                    output->tile(0, 0, W, H);
+                written &= output && output->finish();
+            };
+            for (const std::string &path : outputs)
+                write(path, images[b].data());
+            for (const std::string &path : linearOutputs)
+                write(path, linears[b].data());
+            outputTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - o1).count();
+        };
+
+        const auto s1 = std::chrono::high_resolution_clock::now();
+        uint32_t f = 0;
+        for (; f < uint32_t(frames) && !Stop; f++) {
+            const int b = f & 1;
+            const auto f1 = std::chrono::high_resolution_clock::now();
+            if (f > 0) {
+                animation.apply(scene, f);
+                if (rebuild)
+                    scene.build();
+                else
+                    scene.refit();
+            }
+            const auto f2 = std::chrono::high_resolution_clock::now();
+
+            Accum.assign(W*H, PixelEstimate());
+            Linear.swap(linears[b]);
+            jobs.build(W, H, block, images[b].data());
+            jobs.reset(threadCount);
+            if (f > 0)
+                spawn_threads([&write_frame, f, b]() { write_frame(f - 1, b ^ 1); });
+            else
+                spawn_threads();
+            for (int thr=0; thr < threadCount; thr++)
+                threads[thr].join();
+            Linear.swap(linears[b]);
+            const auto f3 = std::chrono::high_resolution_clock::now();
+
+            std::cout << "frame " << f << ": " << (f == 0 ? "build " : rebuild ? "rebuild " : "refit ")
+                      << (f == 0 ? scene.bvh().buildTime : std::chrono::duration<double, std::milli>(f2 - f1).count()) << "ms, SAH "
+                      << scene.bvh().sah() << ", render " << std::chrono::duration<double, std::milli>(f3 - f2).count() << "ms";
+            if (f > 0)
+                std::cout << ", frame " << f - 1 << " written in " << outputTime << "ms meanwhile";
+            std::cout << "\n";
         }
+        if (f > 0 && !Stop) {
+            write_frame(f - 1, (f - 1) & 1);
+            std::cout << "frame " << f - 1 << " written in " << outputTime << "ms\n";
+        }
+        const auto s2 = std::chrono::high_resolution_clock::now();
+        std::cout << f << " frames, " << std::chrono::duration<double, std::milli>(s2 - s1).count() << "ms\n";
+        return written && !Stop ? 0 : 1;
     }
 
+    // tiles are written as they finish, outputs get the tone mapped image, linear outputs the unmapped one,
+    // a denoised frame is written as a single tile at the end
+    if (outputs.empty() && linearOutputs.empty())
+        outputs.emplace_back("render.ppm");
+    const int band = denoising ? H : block;
+    for (const std::string &path : outputs)
+        Outputs.push_back(ImageOutput::open(path, image, W, H, band, outputMode, compression));
+    for (const std::string &path : linearOutputs)
+        Outputs.push_back(ImageOutput::open(path, Linear.data(), W, H, band, outputMode, compression));
+    if (std::find(Outputs.begin(), Outputs.end(), nullptr) != Outputs.end())
+        return 1;
+
     #ifdef USEGL
     std::random_shuffle(jobs.tasks.begin(), jobs.tasks.end());
 
@@ -140,14 +860,91 @@ int main() {
     glfwSwapInterval(1);
     #endif
 
-    std::thread threads[THREADS];
+    jobs.reset(threadCount);
+
+    std::signal(SIGINT, [](int) { Stop = true; });
+    std::signal(SIGTERM, [](int) { Stop = true; });
+
+    // writes a checkpoint every checkpointInterval seconds until the render is done
+    std::mutex checkpointLock;
+    std::condition_variable checkpointWake;
+    bool rendered = false;
+    std::thread checkpointer;
+    if (!checkpointPath.empty()) {
+        checkpointer = std::thread([&]() {
+            std::unique_lock lock(checkpointLock);
+            while (!checkpointWake.wait_for(lock, std::chrono::duration<double>(checkpointInterval), [&]() { return rendered; })) {
+                lock.unlock();
+                checkpoint(key).save(checkpointPath);
+                lock.lock();
+            }
+        });
+    }
 
     auto t1 = std::chrono::high_resolution_clock::now();
 
-    for (int thr=0; thr < THREADS; thr++) {
-        threads[thr] = std::thread(render_thread, &jobs);
+    // a coordinator renders nothing itself, its one thread hands out tiles and commits the returned ones
+    std::vector<pid_t> children;
+    bool distributed = true;
+    if (!serveAddress.empty()) {
+        // local workers run this binary with the same arguments, connecting instead of serving
+        for (int k = 0; k < spawn; k++) {
+            std::vector<char*> args;
+            for (int i = 0; i < argc; i++) {
+                if (!strcmp(argv[i], "--spawn")) {
+                    i++;
+                    continue;
+                }
+                args.push_back(strcmp(argv[i], "--serve") ? argv[i] : const_cast<char*>("--connect"));
+            }
+            args.push_back(nullptr);
+            const pid_t pid = fork();
+            if (pid == 0) {
+                execv("/proc/self/exe", args.data());
+                _exit(127);
+            }
+            if (pid > 0)
+                children.push_back(pid);
+        }
+
+        threads.resize(1);
+        threads[0] = std::thread([&]() {
+            distributed = coordinate(serveAddress, settingsHash, jobs.tasks, Accum.data(), W,
+                                     [](const Task &task, const PixelEstimate *estimates) { commit_tile(&task, estimates); },
+                                     Stop, children);
+        });
+        threadCount = 0;
     }
 
+    /*
+        Training passes of 1, 2, 4, ... samples per pixel, each guided by what
+        the ones before learned. Their samples are unbiased and stay in Accum,
+        the render only adds the rest.
+    */
+    if (PathGuide) {
+        PathGuide->training = true;
+        for (int pass = 0; pass < guidePasses && !Stop; pass++) {
+            // the render itself takes at least one more sample
+            if ((2u << pass) - 1 >= Samples)
+                break;
+            auto g1 = std::chrono::high_resolution_clock::now();
+            TrainingSamples = (2u << pass) - 1;
+            jobs.reset(threadCount);
+            spawn_threads();
+            for (int thr=0; thr < threadCount; thr++)
+                threads[thr].join();
+            PathGuide->refine(pass);
+            auto g2 = std::chrono::high_resolution_clock::now();
+            std::cout << "guide pass " << pass << ": " << TrainingSamples << " spp, " << PathGuide->leaves() << " regions, "
+                      << PathGuide->directionalNodes() << " directional nodes, "
+                      << std::chrono::duration<double, std::milli>(g2 - g1).count() << "ms\n";
+        }
+        PathGuide->training = false;
+        TrainingSamples = 0;
+        jobs.reset(threadCount);
+    }
+    spawn_threads();
+
     #ifdef USEGL
     double lastUpdate = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
@@ -158,7 +955,7 @@ int main() {
             lastUpdate = t;
             int percProg = clamp(1.0 * jobs.getProgress() / jobs.tasks.size()) * 100;
             glfwSetWindowTitle(window, ("RayTracer " + std::to_string(percProg)).c_str());
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, W, H, GL_RGB, GL_FLOAT, Pixels.data());
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, W, H, GL_RGB, GL_FLOAT, image);
         }
         glBegin(GL_QUADS);
         glTexCoord2i(0, 1);
@@ -181,24 +978,123 @@ int main() {
     glfwTerminate();
     #endif
 
-    for (int thr=0; thr < THREADS; thr++) {
-        threads[thr].join();
+    for (std::thread &thr : threads) {
+        thr.join();
+    }
+    if (checkpointer.joinable()) {
+        {
+            std::lock_guard lock(checkpointLock);
+            rendered = true;
+        }
+        checkpointWake.notify_one();
+        checkpointer.join();
+    }
+
+    for (pid_t pid : children)
+        waitpid(pid, nullptr, 0);
+
+    // the final checkpoint allows adding samples later with a higher --samples
+    if (!checkpointPath.empty() && !checkpoint(key).save(checkpointPath))
+        return 1;
+    if (Stop || !distributed) {
+        if (!checkpointPath.empty())
+            std::cout << "\ninterrupted, continue with --checkpoint " << checkpointPath << "\n";
+        return 1;
     }
 
     auto t2 = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>( t2 - t1 ).count();
     std::cout << std::endl << duration << "ms\n";
 
+    if (denoising) {
+        denoise(Accum.data(), W, H, denoiseSettings, std::max(1u, std::thread::hardware_concurrency()), Linear.data());
+        auto write = [&]() {
+            for (int i = 0; i < W*H; i++)
+                image[i] = ACESFilm(Linear[i]);
+        };
+        if (LivePreview)
+            LivePreview->frame(write);
+        else
+            write();
+        for (const std::unique_ptr<ImageOutput> &output : Outputs)
+            output->tile(0, 0, W, H);
+        const auto d2 = std::chrono::high_resolution_clock::now();
+        std::cout << "denoise: " << std::chrono::duration<double, std::milli>(d2 - t2).count() << "ms\n";
+        t2 = d2;
+    }
 
-    std::ofstream f("raw.data", std::ios::binary);
-    for (int i=0; i < H; i++) {
-        for (int j=0; j < W; j++) {
-            const Vec3 &c = Pixels[i * W + j];
-            uint8_t r = static_cast<uint8_t>(clamp(c.r, 0, 1) * 255.0);
-            uint8_t g = static_cast<uint8_t>(clamp(c.g, 0, 1) * 255.0);
-            uint8_t b = static_cast<uint8_t>(clamp(c.b, 0, 1) * 255.0);
+    if (LivePreview)
+        LivePreview->finish();
 
-            f << r << g << b;
+    bool written = true;
+    for (const std::unique_ptr<ImageOutput> &output : Outputs)
+        written &= output->finish();
+    auto t3 = std::chrono::high_resolution_clock::now();
+    std::cout << "output: " << std::chrono::duration<double, std::milli>(t3 - t2).count() << "ms after the last tile\n";
+    if (!written)
+        return 1;
+
+    // first hit buffers the denoiser works from, averaged over the samples of each pixel
+    const std::pair<const std::string&, Vec3 (*)(const Features&)> aovs[] = {
+        { albedoPath, [](const Features &f) { return f.albedo; } },
+        { normalPath, [](const Features &f) { return f.normal; } },
+        { depthPath, [](const Features &f) { return Vec3(f.depth); } },
+    };
+    for (const auto &[path, channel] : aovs) {
+        if (path.empty())
+            continue;
+        std::vector<Vec3> aov(W*H);
+        for (int i = 0; i < W*H; i++)
+            aov[i] = channel(Accum[i].meanFeatures());
+        std::unique_ptr<ImageOutput> output = ImageOutput::open(path, aov.data(), W, H, H);
+        if (output) {
+            output->tile(0, 0, W, H);
+            if (output->finish())
+                std::cout << "aov: " << path << "\n";
+        }
+    }
+
+#ifdef RT_STATS
+    // the render threads have exited, their counters are in totals()
+    if (!statsPath.empty() && totals().write(statsPath))
+        std::cout << "statistics: " << statsPath << "\n";
+    if (!heatmapPath.empty()) {
+        // traversal work per pixel, black - red - yellow - white up to the most expensive pixel
+        const double maxCost = std::max<uint64_t>(1, *std::max_element(Cost.begin(), Cost.end()));
+        std::vector<Vec3> heat(W*H);
+        for (int i = 0; i < W*H; i++) {
+            const Float t = Cost[i] / maxCost * 3;
+            heat[i] = Vec3(clamp(t), clamp(t - 1), clamp(t - 2));
+        }
+        std::unique_ptr<ImageOutput> output = ImageOutput::open(heatmapPath, heat.data(), W, H, H);
+        if (output) {
+            output->tile(0, 0, W, H);
+            if (output->finish())
+                std::cout << "heatmap: " << heatmapPath << "\n";
+        }
+    }
+#endif
+
+    if (adaptive.threshold > 0) {
+        uint32_t maxCount = 1;
+        uint64_t total = 0;
+        for (const PixelEstimate &e : Accum) {
+            maxCount = std::max(maxCount, e.count);
+            total += e.count;
+        }
+        std::cout << "average " << double(total) / (W*H) << " spp, max " << maxCount << " spp\n";
+
+        if (!sampleMapPath.empty()) {
+            // sample count per pixel, scaled so the busiest pixel is white
+            std::vector<Vec3> map(W*H);
+            for (int i = 0; i < W*H; i++)
+                map[i] = Vec3(Float(Accum[i].count) / maxCount);
+            std::unique_ptr<ImageOutput> output = ImageOutput::open(sampleMapPath, map.data(), W, H, H);
+            if (output) {
+                output->tile(0, 0, W, H);
+                if (output->finish())
+                    std::cout << "sample map: " << sampleMapPath << "\n";
+            }
         }
     }
 
@@ -0,0 +1,133 @@
+#pragma once
+#include "Vector.hpp"
+#include <cstdint>
+
+/*
+    Counter-based sampling: every value is a pure function of
+    (seed, pixel, sample, dimension), so renders are reproducible regardless of
+    thread scheduling, and a path can be resumed from just those four numbers.
+*/
+
+// PCG output permutation used as an integer hash
+constexpr uint32_t pcg_hash(uint32_t x) {
+    const uint32_t state = x * 747796405u + 2891336453u;
+    const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+constexpr uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras style hash, flips bits only depending on less significant ones
+constexpr uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling of a 32 bit fixed point value [Burley 2020]
+constexpr uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+/*
+    The first two Sobol dimensions. Dimension 0 is the bit reversed index,
+    dimension 1 is xor-ed together from one 256 entry table per index byte.
+*/
+struct SobolTables {
+    uint32_t dim1[4][256];
+
+    constexpr SobolTables() : dim1() {
+        // generator matrix columns of the primitive polynomial x + 1
+        uint32_t v[32] = { 0x80000000u };
+        for (int bit = 1; bit < 32; bit++)
+            v[bit] = v[bit-1] ^ (v[bit-1] >> 1);
+
+        for (int byte = 0; byte < 4; byte++) {
+            for (uint32_t value = 0; value < 256; value++) {
+                uint32_t x = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if (value & (1u << bit))
+                        x ^= v[8*byte + bit];
+                }
+                dim1[byte][value] = x;
+            }
+        }
+    }
+};
+
+constexpr static SobolTables SOBOL_TABLES;
+
+constexpr uint32_t sobol(uint32_t index, int dim) {
+    if (dim == 0)
+        return reverse_bits(index);
+    return SOBOL_TABLES.dim1[0][index & 0xFF] ^ SOBOL_TABLES.dim1[1][(index >> 8) & 0xFF]
+         ^ SOBOL_TABLES.dim1[2][(index >> 16) & 0xFF] ^ SOBOL_TABLES.dim1[3][index >> 24];
+}
+
+constexpr Float to_unit_float(uint32_t x) {
+    return Float(x >> 8) * Float(1.0 / (1 << 24));
+}
+
+class Sampler {
+public:
+    enum Type : uint8_t { RANDOM, SOBOL };
+
+    Sampler() = default;
+    constexpr Sampler(Type type, uint32_t seed) : m_type(type), m_seed(seed) {}
+
+    constexpr void start(uint32_t pixel, uint32_t sample) {
+        m_pixel = pixel;
+        m_sample = sample;
+        m_dim = 0;
+    }
+
+    constexpr uint32_t dimension() const { return m_dim; }
+
+    /*
+        Sobol values are padded: every 1D or 2D request is its own
+        Owen-scrambled (0,2)-sequence, shuffled per pixel and dimension.
+    */
+    inline Float get1D() {
+        const uint32_t key = next_key(1);
+        if (m_type == RANDOM)
+            return to_unit_float(pcg_hash(key ^ pcg_hash(m_sample)));
+
+        const uint32_t index = nested_uniform_scramble(m_sample, key);
+        return to_unit_float(nested_uniform_scramble(sobol(index, 0), pcg_hash(key ^ 1)));
+    }
+
+    inline Vec2 get2D() {
+        const uint32_t key = next_key(2);
+        if (m_type == RANDOM) {
+            const uint32_t h = pcg_hash(key ^ pcg_hash(m_sample));
+            return Vec2(to_unit_float(h), to_unit_float(pcg_hash(h)));
+        }
+
+        const uint32_t index = nested_uniform_scramble(m_sample, key);
+        return Vec2(
+            to_unit_float(nested_uniform_scramble(sobol(index, 0), pcg_hash(key ^ 1))),
+            to_unit_float(nested_uniform_scramble(sobol(index, 1), pcg_hash(key ^ 2))));
+    }
+
+private:
+    Type m_type{ SOBOL };
+    uint32_t m_seed{ 0 };
+    uint32_t m_pixel{ 0 };
+    uint32_t m_sample{ 0 };
+    uint32_t m_dim{ 0 };
+
+    inline uint32_t next_key(uint32_t dims) {
+        const uint32_t key = pcg_hash(m_dim + pcg_hash(m_pixel + pcg_hash(m_seed)));
+        m_dim += dims;
+        return key;
+    }
+};
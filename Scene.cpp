@@ -0,0 +1,453 @@
+#include "Scene.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+
+uint32_t Scene::addMaterial(const Material &M) {
+    const MaterialRecord record = M.record();
+    for (uint32_t i = 0; i < materials.size(); i++) {
+        if (materials[i].record() == record)
+            return i;
+    }
+    materials.push_back(M);
+    return materials.size() - 1;
+}
+
+uint32_t Scene::addGeometry(const Mesh &part, uint16_t M) {
+    geometries.push_back(Geometry{ uint32_t(geometry.triangles()), uint32_t(part.triangles()) });
+    geometry.append(part, M);
+    return geometries.size() - 1;
+}
+
+void Scene::build() {
+    buildGeometries();
+    for (Instance &instance : instances)
+        instance.bounds = instance.toWorld.bounds(geometries[instance.geometry].bounds);
+
+    std::vector<AABB> bounds;
+    bounds.reserve(spheres.size() + triangles.size() + mesh.triangles() + instances.size());
+    for (const Sphere &s : spheres)
+        bounds.push_back(s.bounds());
+    for (const Triangle &t : triangles)
+        bounds.push_back(t.bounds());
+    for (uint32_t i = 0; i < mesh.triangles(); i++)
+        bounds.push_back(mesh.bounds(i));
+    for (const Instance &instance : instances)
+        bounds.push_back(instance.bounds);
+
+    m_bvh.build(bounds, LANES);
+
+    // BVH indices count through spheres, then triangles, then mesh triangles, then instances
+    const uint32_t meshStart = spheres.size() + triangles.size();
+    const uint32_t instanceStart = meshStart + mesh.triangles();
+    if (sphereIds.size() != spheres.size()) {
+        sphereIds.resize(spheres.size());
+        std::iota(sphereIds.begin(), sphereIds.end(), 0);
+    }
+    std::vector<Sphere> orderedSpheres;
+    std::vector<uint32_t> orderedIds;
+    std::vector<Triangle> orderedTriangles;
+    std::vector<uint32_t> orderedIndices;
+    std::vector<uint16_t> orderedMaterial;
+    std::vector<Instance> orderedInstances;
+    orderedSpheres.reserve(spheres.size());
+    orderedIds.reserve(spheres.size());
+    orderedTriangles.reserve(triangles.size());
+    orderedIndices.reserve(mesh.indices.size());
+    orderedMaterial.reserve(mesh.material.size());
+    orderedInstances.reserve(instances.size());
+    m_leaves.clear();
+
+    for (BVHNode &node : m_bvh.nodes) {
+        if (!node.leaf())
+            continue;
+
+        Leaf leaf{ uint32_t(orderedSpheres.size()), uint32_t(orderedTriangles.size()), uint32_t(orderedMaterial.size()),
+                   uint32_t(orderedInstances.size()), 0, 0, 0, 0 };
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+            const uint32_t index = m_bvh.indices[i];
+            if (index < spheres.size()) {
+                orderedSpheres.push_back(spheres[index]);
+                orderedIds.push_back(sphereIds[index]);
+                leaf.spheres++;
+            }
+            else if (index < meshStart) {
+                orderedTriangles.push_back(triangles[index - spheres.size()]);
+                leaf.triangles++;
+            }
+            else if (index < instanceStart) {
+                const uint32_t tri = index - meshStart;
+                orderedIndices.insert(orderedIndices.end(), &mesh.indices[3*tri], &mesh.indices[3*tri] + 3);
+                orderedMaterial.push_back(mesh.material[tri]);
+                leaf.meshTriangles++;
+            }
+            else {
+                orderedInstances.push_back(instances[index - instanceStart]);
+                leaf.instances++;
+            }
+        }
+        node.offset = m_leaves.size();
+        m_leaves.push_back(leaf);
+    }
+
+    spheres.swap(orderedSpheres);
+    sphereIds.swap(orderedIds);
+    triangles.swap(orderedTriangles);
+    mesh.indices.swap(orderedIndices);
+    mesh.material.swap(orderedMaterial);
+    instances.swap(orderedInstances);
+
+    m_wide.build(m_bvh);
+    buildSoA();
+    buildLights();
+}
+
+void Scene::refit() {
+    for (Instance &instance : instances)
+        instance.bounds = instance.toWorld.bounds(geometries[instance.geometry].bounds);
+
+    m_bvh.refit([&](const BVHNode &node) {
+        const Leaf &leaf = m_leaves[node.offset];
+        AABB b;
+        for (uint32_t i = leaf.sphere; i < leaf.sphere + leaf.spheres; i++)
+            b.extend(spheres[i].bounds());
+        for (uint32_t i = leaf.triangle; i < leaf.triangle + leaf.triangles; i++)
+            b.extend(triangles[i].bounds());
+        for (uint32_t i = leaf.meshTriangle; i < leaf.meshTriangle + leaf.meshTriangles; i++)
+            b.extend(mesh.bounds(i));
+        for (uint32_t i = leaf.instance; i < leaf.instance + leaf.instances; i++)
+            b.extend(instances[i].bounds);
+        return b;
+    });
+
+    m_wide.build(m_bvh);
+    buildSoA();
+    buildLights();
+}
+
+// one BVH per geometry into m_blas, the triangles of each geometry reordered into its leaf order
+void Scene::buildGeometries() {
+    m_blas.nodes.clear();
+    std::vector<uint32_t> orderedIndices(geometry.indices.size());
+    std::vector<uint16_t> orderedMaterial(geometry.material.size());
+    for (Geometry &g : geometries) {
+        std::vector<AABB> bounds;
+        bounds.reserve(g.triangles);
+        for (uint32_t i = g.triangle; i < g.triangle + g.triangles; i++)
+            bounds.push_back(geometry.bounds(i));
+        BVH bvh;
+        bvh.build(bounds);
+
+        for (uint32_t i = 0; i < g.triangles; i++) {
+            const uint32_t tri = g.triangle + bvh.indices[i];
+            std::copy(&geometry.indices[3*tri], &geometry.indices[3*tri] + 3, &orderedIndices[3*(g.triangle + i)]);
+            orderedMaterial[g.triangle + i] = geometry.material[tri];
+        }
+
+        // leaves point at their triangles directly, inner nodes at their second child in m_blas
+        g.root = m_blas.nodes.size();
+        g.bounds = bvh.nodes[0].bounds;
+        for (BVHNode node : bvh.nodes) {
+            node.offset += node.leaf() ? g.triangle : g.root;
+            m_blas.nodes.push_back(node);
+        }
+    }
+    geometry.indices.swap(orderedIndices);
+    geometry.material.swap(orderedMaterial);
+}
+
+void Scene::buildLights() {
+    lights.clear();
+    m_lightCdf.clear();
+    for (uint32_t i = 0; i < spheres.size(); i++) {
+        if (materials[spheres[i].material].emissive())
+            lights.push_back(Handle{ TYPE::SPHERE, i });
+    }
+    for (uint32_t i = 0; i < triangles.size(); i++) {
+        if (materials[triangles[i].material].emissive())
+            lights.push_back(Handle{ TYPE::TRIANGLE, i });
+    }
+    Float sum = 0;
+    for (const Handle h : lights) {
+        sum += lightPower(h);
+        m_lightCdf.push_back(sum);
+    }
+}
+
+void Scene::buildSoA() {
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+    m_sphereSoA.build(spheres);
+    m_triangleSoA.build(triangles);
+    m_planeSoA.build(planes);
+#endif
+}
+
+/*
+    Cache file layout: a header followed by one array per section, each starting
+    at a 64 byte aligned offset. Everything is stored exactly as it is in memory,
+    loading is one copy per array. Changes to any stored type or to the build
+    have to bump VERSION.
+*/
+namespace {
+
+constexpr char MAGIC[4] = { 'R', 'T', 'S', 'C' };
+constexpr uint32_t VERSION = 2;
+constexpr size_t ALIGN = 64;
+
+enum Section {
+    MATERIALS, SPHERES, TRIANGLES, PLANES, VERTICES, NORMALS, INDICES, MESH_MATERIAL, NODES, LEAVES,
+    GEOMETRY_VERTICES, GEOMETRY_NORMALS, GEOMETRY_INDICES, GEOMETRY_MATERIAL, GEOMETRIES, INSTANCES, BLAS_NODES, SECTIONS
+};
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    struct {
+        uint64_t offset;
+        uint64_t count;
+    } sections[SECTIONS];
+};
+
+template <typename T>
+uint64_t hash_array(const std::vector<T> &a, uint64_t h) {
+    const uint64_t n = a.size();
+    h = hash_bytes(&n, sizeof(n), h);
+    return hash_bytes(a.data(), a.size() * sizeof(T), h);
+}
+
+}
+
+uint64_t Scene::hash() const {
+    // the BVH leaf size depends on the kernels
+    const uint32_t format[2] = { VERSION, uint32_t(LANES) };
+    uint64_t h = hash_bytes(format, sizeof(format));
+
+    std::vector<MaterialRecord> records;
+    for (const Material &m : materials)
+        records.push_back(m.record());
+    h = hash_array(records, h);
+    h = hash_array(spheres, h);
+    h = hash_array(triangles, h);
+    h = hash_array(planes, h);
+    h = hash_array(mesh.vertices, h);
+    h = hash_array(mesh.normals, h);
+    h = hash_array(mesh.indices, h);
+    h = hash_array(mesh.material, h);
+    h = hash_array(geometry.vertices, h);
+    h = hash_array(geometry.normals, h);
+    h = hash_array(geometry.indices, h);
+    h = hash_array(geometry.material, h);
+    h = hash_array(geometries, h);
+    return hash_array(instances, h);
+}
+
+bool Scene::save(const std::string &path, uint64_t key) const {
+    std::vector<MaterialRecord> records;
+    for (const Material &m : materials)
+        records.push_back(m.record());
+
+    const std::pair<const void*, size_t> arrays[SECTIONS] = {
+        { records.data(), sizeof(MaterialRecord) },
+        { spheres.data(), sizeof(Sphere) },
+        { triangles.data(), sizeof(Triangle) },
+        { planes.data(), sizeof(Plane) },
+        { mesh.vertices.data(), sizeof(Vec3) },
+        { mesh.normals.data(), sizeof(Vec3) },
+        { mesh.indices.data(), sizeof(uint32_t) },
+        { mesh.material.data(), sizeof(uint16_t) },
+        { m_bvh.nodes.data(), sizeof(BVHNode) },
+        { m_leaves.data(), sizeof(Leaf) },
+        { geometry.vertices.data(), sizeof(Vec3) },
+        { geometry.normals.data(), sizeof(Vec3) },
+        { geometry.indices.data(), sizeof(uint32_t) },
+        { geometry.material.data(), sizeof(uint16_t) },
+        { geometries.data(), sizeof(Geometry) },
+        { instances.data(), sizeof(Instance) },
+        { m_blas.nodes.data(), sizeof(BVHNode) },
+    };
+    const size_t counts[SECTIONS] = {
+        records.size(), spheres.size(), triangles.size(), planes.size(),
+        mesh.vertices.size(), mesh.normals.size(), mesh.indices.size(), mesh.material.size(),
+        m_bvh.nodes.size(), m_leaves.size(),
+        geometry.vertices.size(), geometry.normals.size(), geometry.indices.size(), geometry.material.size(),
+        geometries.size(), instances.size(), m_blas.nodes.size()
+    };
+
+    CacheHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.key = key;
+    uint64_t offset = sizeof(CacheHeader);
+    for (int s = 0; s < SECTIONS; s++) {
+        offset = (offset + ALIGN - 1) / ALIGN * ALIGN;
+        header.sections[s] = { offset, counts[s] };
+        offset += counts[s] * arrays[s].second;
+    }
+
+    // written next to the target and renamed, a reader never sees a partial file,
+    // the pid keeps processes that share the cache from writing the same one
+    const std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t pos = sizeof(header);
+        const char zeros[ALIGN] = {};
+        for (int s = 0; s < SECTIONS; s++) {
+            f.write(zeros, header.sections[s].offset - pos);
+            f.write(static_cast<const char*>(arrays[s].first), counts[s] * arrays[s].second);
+            pos = header.sections[s].offset + counts[s] * arrays[s].second;
+        }
+        if (!f) {
+            std::cerr << tmp << ": can't write scene cache\n";
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << path << ": can't write scene cache\n";
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Scene::load(const std::string &path, uint64_t key) {
+    MappedFile file;
+    if (!file.open(path, MADV_WILLNEED))
+        return false;
+
+    CacheHeader header;
+    if (file.size < sizeof(header))
+        return false;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.key != key)
+        return false;
+
+    const size_t sizes[SECTIONS] = {
+        sizeof(MaterialRecord), sizeof(Sphere), sizeof(Triangle), sizeof(Plane),
+        sizeof(Vec3), sizeof(Vec3), sizeof(uint32_t), sizeof(uint16_t), sizeof(BVHNode), sizeof(Leaf),
+        sizeof(Vec3), sizeof(Vec3), sizeof(uint32_t), sizeof(uint16_t), sizeof(Geometry), sizeof(Instance), sizeof(BVHNode)
+    };
+    for (int s = 0; s < SECTIONS; s++) {
+        const auto &section = header.sections[s];
+        if (section.offset % ALIGN || section.offset > file.size || section.count > (file.size - section.offset) / sizes[s]) {
+            std::cerr << path << ": corrupt scene cache\n";
+            return false;
+        }
+    }
+
+    auto copy = [&](Section s, auto &array) {
+        using T = typename std::remove_reference_t<decltype(array)>::value_type;
+        const T *first = reinterpret_cast<const T*>(file.data + header.sections[s].offset);
+        array.assign(first, first + header.sections[s].count);
+    };
+
+    std::vector<MaterialRecord> records;
+    copy(MATERIALS, records);
+    Scene loaded;
+    for (const MaterialRecord &r : records) {
+        const std::optional<Material> m = make_material(r);
+        if (!m) {
+            std::cerr << path << ": corrupt scene cache\n";
+            return false;
+        }
+        loaded.materials.push_back(*m);
+    }
+
+    copy(SPHERES, loaded.spheres);
+    copy(TRIANGLES, loaded.triangles);
+    copy(PLANES, loaded.planes);
+    copy(VERTICES, loaded.mesh.vertices);
+    copy(NORMALS, loaded.mesh.normals);
+    copy(INDICES, loaded.mesh.indices);
+    copy(MESH_MATERIAL, loaded.mesh.material);
+    copy(NODES, loaded.m_bvh.nodes);
+    copy(LEAVES, loaded.m_leaves);
+    copy(GEOMETRY_VERTICES, loaded.geometry.vertices);
+    copy(GEOMETRY_NORMALS, loaded.geometry.normals);
+    copy(GEOMETRY_INDICES, loaded.geometry.indices);
+    copy(GEOMETRY_MATERIAL, loaded.geometry.material);
+    copy(GEOMETRIES, loaded.geometries);
+    copy(INSTANCES, loaded.instances);
+    copy(BLAS_NODES, loaded.m_blas.nodes);
+    if (!loaded.valid()) {
+        std::cerr << path << ": corrupt scene cache\n";
+        return false;
+    }
+
+    // this scene stays as it was unless the whole file checks out
+    loaded.wide = wide;
+    *this = std::move(loaded);
+    m_wide.build(m_bvh);
+    buildSoA();
+    buildLights();
+    return true;
+}
+
+namespace {
+
+// children after their parent and no deeper than the traversal stack, valid_leaf(node) checks the leaves
+template <typename F>
+bool valid_tree(const std::vector<BVHNode> &nodes, F &&valid_leaf) {
+    std::vector<uint8_t> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const BVHNode &node = nodes[i];
+        if (node.leaf()) {
+            if (!valid_leaf(node))
+                return false;
+            continue;
+        }
+        if (node.offset <= i + 1 || node.offset >= nodes.size() || depth[i] + 1 >= BVH::STACK_SIZE)
+            return false;
+        depth[i + 1] = std::max<uint8_t>(depth[i + 1], depth[i] + 1);
+        depth[node.offset] = std::max<uint8_t>(depth[node.offset], depth[i] + 1);
+    }
+    return true;
+}
+
+// whole triangles over existing vertices, one material each, normals for all vertices or none
+bool valid_mesh(const Mesh &mesh, size_t materials) {
+    if (mesh.indices.size() % 3 || mesh.material.size() != mesh.triangles()
+        || (!mesh.normals.empty() && mesh.normals.size() != mesh.vertices.size()))
+        return false;
+    return std::all_of(mesh.indices.begin(), mesh.indices.end(), [&](uint32_t i) { return i < mesh.vertices.size(); })
+        && std::all_of(mesh.material.begin(), mesh.material.end(), [&](uint16_t M) { return M < materials; });
+}
+
+// [first, first + count) within size
+inline bool in_range(uint64_t first, uint64_t count, size_t size) { return first + count <= size; }
+
+}
+
+bool Scene::valid() const {
+    const size_t M = materials.size();
+    auto material = [&](const Object &o) { return o.material < M; };
+    if (!std::all_of(spheres.begin(), spheres.end(), material) || !std::all_of(triangles.begin(), triangles.end(), material)
+        || !std::all_of(planes.begin(), planes.end(), material))
+        return false;
+    if (!valid_mesh(mesh, M) || !valid_mesh(geometry, M))
+        return false;
+
+    for (const Geometry &g : geometries) {
+        if (!g.triangles || !in_range(g.triangle, g.triangles, geometry.triangles()) || g.root >= m_blas.nodes.size())
+            return false;
+    }
+    for (const Instance &instance : instances) {
+        if (instance.geometry >= geometries.size() || (instance.material != Instance::OWN_MATERIAL && instance.material >= M))
+            return false;
+    }
+    for (const Leaf &leaf : m_leaves) {
+        if (!in_range(leaf.sphere, leaf.spheres, spheres.size()) || !in_range(leaf.triangle, leaf.triangles, triangles.size())
+            || !in_range(leaf.meshTriangle, leaf.meshTriangles, mesh.triangles()) || !in_range(leaf.instance, leaf.instances, instances.size()))
+            return false;
+    }
+
+    return valid_tree(m_bvh.nodes, [&](const BVHNode &node) { return node.offset < m_leaves.size(); })
+        && valid_tree(m_blas.nodes, [&](const BVHNode &node) { return in_range(node.offset, node.count, geometry.triangles()); });
+}
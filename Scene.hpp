@@ -0,0 +1,450 @@
+#pragma once
+#include "Object.hpp"
+#include "BVH.hpp"
+#include "WideBVH.hpp"
+#include "Kernels.hpp"
+#include "Mesh.hpp"
+#include "Color.hpp"
+#include <algorithm>
+#include <vector>
+#include <string>
+
+/*
+    Owns the primitives, one contiguous array per type, and the acceleration
+    structure over them. Primitives are referred to by Handle and dispatched
+    statically on their type.
+    build() reorders spheres and triangles into BVH leaf order, so every leaf
+    covers one contiguous range per primitive type. Unbounded planes can't be
+    put into the BVH and are tested linearly.
+    Primitives refer to their material by index into materials, so the whole
+    built scene can be written to and read back from a binary cache file as is.
+    Spheres and triangles with an emissive material are the lights, they are
+    picked in proportion to their power for light sampling.
+    Instances are a second level: the scene's BVH holds their world bounds,
+    below that every geometry has its own BVH over its triangles in object
+    space, however many instances share it.
+*/
+
+// a range of Scene::geometry shared by instances
+struct Geometry {
+    uint32_t triangle;  // first triangle
+    uint32_t triangles;
+    uint32_t root{ 0 }; // its BVH in the bottom level, filled in by build()
+    AABB bounds;        // object space, filled in by build()
+};
+
+// a point on a light seen from a shading point, pdf is per solid angle and includes picking the light
+struct LightSample {
+    Vec3 direction;
+    Float distance;
+    Float pdf{ 0 };
+    Vec3 Le;
+};
+
+class Scene {
+public:
+    std::vector<Sphere> spheres;
+    std::vector<Triangle> triangles;
+    std::vector<Plane> planes;
+    Mesh mesh;
+    Mesh geometry; // the triangles of all geometries, see addGeometry()
+    std::vector<Geometry> geometries;
+    std::vector<Instance> instances;
+    std::vector<Material> materials;
+    std::vector<Handle> lights; // filled in by build() and load()
+    bool wide{ false }; // rays traverse the quantized four wide BVH instead of the binary one
+    std::vector<uint32_t> sphereIds; // by build(): the index spheres[i] had before the first build, empty after load()
+
+    // index of a material equal to M, M is added if there is none yet
+    uint32_t addMaterial(const Material &M);
+
+    // adds a non-empty mesh with material M as a geometry for instances, returns its index in geometries
+    uint32_t addGeometry(const Mesh &part, uint16_t M);
+
+    void build();
+
+    /*
+        Updates the built scene after spheres, mesh vertices, planes or instance
+        transforms moved, keeping the BVH and the order of the primitives.
+    */
+    void refit();
+
+    // hash of the unbuilt scene and its materials
+    uint64_t hash() const;
+
+    /*
+        Writes the built scene to a cache file tagged with key, or replaces this
+        scene with the cached one if the file exists and has a matching key.
+        Both print the reason and return false on failure.
+    */
+    bool save(const std::string &path, uint64_t key) const;
+    bool load(const std::string &path, uint64_t key);
+
+    // closest hit, same semantics as calling hit() on every primitive except prev
+    inline bool intersect(Interaction * const interaction, const Handle prev = Handle()) const {
+        const Ray &ray = *interaction->ray;
+        bool found = false;
+
+    #if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+        Float tmax = interaction->object.type != TYPE::NONE ? interaction->t : INF;
+
+        STAT(threadStats.planes += planes.size());
+        const int p = hit_planes(m_planeSoA, 0, planes.size(), ray, tmax, skip(prev, TYPE::PLANE));
+        if (p >= 0)
+            found = set_hit(interaction, TYPE::PLANE, p, tmax, Vec3(0));
+
+        const int64_t skipSphere = skip(prev, TYPE::SPHERE);
+        const int64_t skipTriangle = skip(prev, TYPE::TRIANGLE);
+        found |= traverse(ray, tmax, [&](const BVHNode &node, Float &t) {
+            const Leaf &leaf = m_leaves[node.offset];
+            STAT(count_tests(leaf));
+            bool hit = false;
+            int i = hit_spheres(m_sphereSoA, leaf.sphere, leaf.spheres, ray, t, skipSphere);
+            if (i >= 0)
+                hit = set_hit(interaction, TYPE::SPHERE, i, t, Vec3(0));
+
+            Vec3 uv;
+            i = hit_triangles(m_triangleSoA, leaf.triangle, leaf.triangles, ray, t, uv, skipTriangle);
+            if (i >= 0)
+                hit = set_hit(interaction, TYPE::TRIANGLE, i, t, uv);
+
+            if (leaf.meshTriangles) {
+                interaction->t = t;
+                hit |= hit_mesh(leaf, interaction, prev);
+                t = interaction->t;
+            }
+            if (leaf.instances) {
+                interaction->t = t;
+                hit |= hit_instances(leaf, interaction, prev);
+                t = interaction->t;
+            }
+            return hit;
+        });
+    #else
+        STAT(threadStats.planes += planes.size());
+        for (uint32_t i = 0; i < planes.size(); i++) {
+            if (prev != Handle{ TYPE::PLANE, i } && planes[i].hit(interaction)) {
+                interaction->object = Handle{ TYPE::PLANE, i };
+                found = true;
+            }
+        }
+
+        const Float tmax = interaction->object.type != TYPE::NONE ? interaction->t : INF;
+        found |= traverse(ray, tmax, [&](const BVHNode &node, Float &t) {
+            const Leaf &leaf = m_leaves[node.offset];
+            STAT(count_tests(leaf));
+            bool hit = false;
+            for (uint32_t i = leaf.sphere; i < leaf.sphere + leaf.spheres; i++) {
+                if (prev != Handle{ TYPE::SPHERE, i } && spheres[i].hit(interaction)) {
+                    interaction->object = Handle{ TYPE::SPHERE, i };
+                    hit = true;
+                }
+            }
+            for (uint32_t i = leaf.triangle; i < leaf.triangle + leaf.triangles; i++) {
+                if (prev != Handle{ TYPE::TRIANGLE, i } && triangles[i].hit(interaction)) {
+                    interaction->object = Handle{ TYPE::TRIANGLE, i };
+                    hit = true;
+                }
+            }
+            hit |= hit_mesh(leaf, interaction, prev);
+            hit |= hit_instances(leaf, interaction, prev);
+            if (hit)
+                t = interaction->t;
+            return hit;
+        });
+    #endif
+
+        return found;
+    }
+
+    // any hit closer than tmax except prev, stops at the first one it finds
+    inline bool occluded(const Ray &ray, Float tmax, const Handle prev = Handle()) const {
+    #if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+        STAT(threadStats.planes += planes.size());
+        Float t = tmax;
+        if (hit_planes(m_planeSoA, 0, planes.size(), ray, t, skip(prev, TYPE::PLANE)) >= 0)
+            return true;
+
+        const int64_t skipSphere = skip(prev, TYPE::SPHERE);
+        const int64_t skipTriangle = skip(prev, TYPE::TRIANGLE);
+        return traverse<true>(ray, tmax, [&](const BVHNode &node, Float &t) {
+            const Leaf &leaf = m_leaves[node.offset];
+            STAT(count_tests(leaf));
+            Float tt = t;
+            if (hit_spheres(m_sphereSoA, leaf.sphere, leaf.spheres, ray, tt, skipSphere) >= 0)
+                return true;
+            Vec3 uv;
+            if (hit_triangles(m_triangleSoA, leaf.triangle, leaf.triangles, ray, tt, uv, skipTriangle) >= 0)
+                return true;
+            return (leaf.meshTriangles && occluded_mesh(leaf, ray, t, prev))
+                || (leaf.instances && occluded_instances(leaf, ray, t, prev));
+        });
+    #else
+        // hit() only accepts crossings closer than t once object is set
+        Interaction interaction(&ray);
+        interaction.object = Handle{ TYPE::PLANE, 0 };
+        interaction.t = tmax;
+        STAT(threadStats.planes += planes.size());
+        for (uint32_t i = 0; i < planes.size(); i++) {
+            if (prev != Handle{ TYPE::PLANE, i } && planes[i].hit(&interaction))
+                return true;
+        }
+
+        return traverse<true>(ray, tmax, [&](const BVHNode &node, Float &t) {
+            const Leaf &leaf = m_leaves[node.offset];
+            STAT(count_tests(leaf));
+            for (uint32_t i = leaf.sphere; i < leaf.sphere + leaf.spheres; i++) {
+                if (prev != Handle{ TYPE::SPHERE, i } && spheres[i].hit(&interaction))
+                    return true;
+            }
+            for (uint32_t i = leaf.triangle; i < leaf.triangle + leaf.triangles; i++) {
+                if (prev != Handle{ TYPE::TRIANGLE, i } && triangles[i].hit(&interaction))
+                    return true;
+            }
+            return occluded_mesh(leaf, ray, t, prev) || occluded_instances(leaf, ray, t, prev);
+        });
+    #endif
+    }
+
+    /*
+        Picks a light with u and a point on it with s, as seen from P: spheres are
+        sampled within the cone they cover, triangles by area. pdf is 0 if the
+        point can't light P.
+    */
+    inline LightSample sampleLight(const Vec3 &P, Float u, const Vec2 &s) const {
+        LightSample sample;
+        if (lights.empty())
+            return sample;
+        const size_t i = std::upper_bound(m_lightCdf.begin(), m_lightCdf.end(), u * m_lightCdf.back()) - m_lightCdf.begin();
+        const Handle h = lights[std::min(i, lights.size() - 1)];
+        const Float pick = lightPower(h) / m_lightCdf.back();
+        sample.Le = material(h)->Le;
+
+        if (h.type == TYPE::SPHERE) {
+            const Sphere &sphere = spheres[h.index];
+            const Vec3 w = sphere.position - P;
+            const Float d2 = w.norm_sqr();
+            const Float r2 = sphere.radius * sphere.radius;
+            if (d2 <= r2)
+                return sample;
+            const Float d = sqrt(d2);
+            const Float cone = cone_solid_angle(r2 / d2);
+            const Float oneMinusCos = s.u * cone * INV_TWO_PI;
+            const Float cos = 1 - oneMinusCos;
+            const Float sin = sqrt(std::max(Float(0), oneMinusCos * (2 - oneMinusCos)));
+            const Float phi = TWO_PI * s.v;
+            Vec3 b1, b2;
+            const Vec3 n = w / d;
+            basis(n, b1, b2);
+            sample.direction = (b1 * std::cos(phi) + b2 * std::sin(phi)) * sin + n * cos;
+            sample.distance = d * cos - sqrt(std::max(Float(0), r2 - d2 * sin * sin));
+            sample.pdf = pick / cone;
+        }
+        else {
+            const Triangle &triangle = triangles[h.index];
+            const Float su = sqrt(s.u);
+            const Vec3 Q = triangle.position + triangle.u * (su * (1 - s.v)) + triangle.v * (su * s.v);
+            const Vec3 w = Q - P;
+            const Float d2 = w.norm_sqr();
+            sample.distance = sqrt(d2);
+            sample.direction = w / sample.distance;
+            const Float area2 = triangle.true_normal.norm();
+            const Float cos = -sample.direction.dot(triangle.true_normal) / area2;
+            if (cos > 0)
+                sample.pdf = pick * d2 / (Float(0.5) * area2 * cos);
+        }
+        return sample;
+    }
+
+    // density sampleLight(ray.position) has for the hit on h at distance t, 0 if h isn't a light
+    inline Float lightPdf(const Ray &ray, const Handle h, Float t) const {
+        if ((h.type != TYPE::SPHERE && h.type != TYPE::TRIANGLE) || !material(h)->emissive())
+            return 0;
+        const Float pick = lightPower(h) / m_lightCdf.back();
+        if (h.type == TYPE::SPHERE) {
+            const Sphere &sphere = spheres[h.index];
+            const Float d2 = (sphere.position - ray.position).norm_sqr();
+            const Float r2 = sphere.radius * sphere.radius;
+            return d2 > r2 ? pick / cone_solid_angle(r2 / d2) : 0;
+        }
+        const Triangle &triangle = triangles[h.index];
+        const Float area2 = triangle.true_normal.norm();
+        const Float cos = -ray.direction.dot(triangle.true_normal) / area2;
+        return cos > 0 ? pick * t * t / (Float(0.5) * area2 * cos) : 0;
+    }
+
+    inline const Material *material(const Handle h) const {
+        switch (h.type) {
+            case TYPE::SPHERE: return &materials[spheres[h.index].material];
+            case TYPE::TRIANGLE: return &materials[triangles[h.index].material];
+            case TYPE::MESH: return &materials[mesh.material[h.index]];
+            case TYPE::INSTANCE: {
+                const uint32_t M = instances[h.index].material;
+                return &materials[M != Instance::OWN_MATERIAL ? M : geometry.material[h.primitive]];
+            }
+            default: return &materials[planes[h.index].material];
+        }
+    }
+
+    // fills in position and normal of a hit found by intersect()
+    inline void update(Interaction * const interaction) const {
+        interaction->position = interaction->ray->at(interaction->t);
+        const uint32_t i = interaction->object.index;
+        switch (interaction->object.type) {
+            case TYPE::SPHERE: interaction->normal = spheres[i].normalAt(interaction); break;
+            case TYPE::TRIANGLE: interaction->normal = triangles[i].normalAt(interaction); break;
+            case TYPE::MESH: interaction->normal = mesh.normalAt(i, interaction); break;
+            case TYPE::INSTANCE: {
+                const Vec3 n = geometry.normalAt(interaction->object.primitive, interaction);
+                interaction->normal = instances[i].toObject.transposed(n).normalize();
+                break;
+            }
+            default: interaction->normal = planes[i].normalAt(interaction); break;
+        }
+    }
+
+    inline const BVH &bvh() const { return m_bvh; }
+    inline const WideBVH &wideBVH() const { return m_wide; }
+
+private:
+    // per-type primitive ranges of one BVH leaf, a leaf node's offset indexes into m_leaves
+    struct Leaf {
+        uint32_t sphere;
+        uint32_t triangle;
+        uint32_t meshTriangle;
+        uint32_t instance;
+        uint16_t spheres;
+        uint16_t triangles;
+        uint16_t meshTriangles;
+        uint16_t instances;
+    };
+
+    BVH m_bvh;
+    WideBVH m_wide; // m_bvh collapsed, rebuilt with it
+    BVH m_blas; // the BVHs of all geometries, leaves are ranges of geometry triangles
+    std::vector<Leaf> m_leaves;
+    std::vector<Float> m_lightCdf; // running sum of the light powers
+
+    void buildGeometries();
+
+    template <bool ANY = false, typename F>
+    inline bool traverse(const Ray &ray, Float tmax, F &&intersect) const {
+        return wide ? m_wide.traverse<ANY>(ray, tmax, intersect) : m_bvh.traverse<ANY>(ray, tmax, intersect);
+    }
+    void buildSoA();
+    void buildLights();
+    // every index of a loaded scene within the array it points into
+    bool valid() const;
+
+    // emitted power up to the constant factor all lights share
+    inline Float lightPower(const Handle h) const {
+        const Float L = luminance(material(h)->Le);
+        if (h.type == TYPE::SPHERE)
+            return L * 2 * TWO_PI * spheres[h.index].radius * spheres[h.index].radius;
+        return L * Float(0.5) * triangles[h.index].true_normal.norm();
+    }
+
+    // solid angle of a sphere seen from a distance where sin^2 of its half angle is sin2
+    static inline Float cone_solid_angle(Float sin2) {
+        // 1 - cos without cancellation for small spheres
+        return TWO_PI * sin2 / (1 + sqrt(1 - sin2));
+    }
+
+#ifdef RT_STATS
+    static inline void count_tests(const Leaf &leaf) {
+        threadStats.spheres += leaf.spheres;
+        threadStats.triangles += leaf.triangles;
+        threadStats.meshTriangles += leaf.meshTriangles;
+    }
+#endif
+
+    // mesh triangles are tested one at a time on the indexed data, interaction->t must be valid on a hit
+    inline bool hit_mesh(const Leaf &leaf, Interaction * const interaction, const Handle prev) const {
+        bool hit = false;
+        for (uint32_t i = leaf.meshTriangle; i < leaf.meshTriangle + leaf.meshTriangles; i++) {
+            if (prev != Handle{ TYPE::MESH, i } && mesh.hit(i, interaction)) {
+                interaction->object = Handle{ TYPE::MESH, i };
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+    inline bool occluded_mesh(const Leaf &leaf, const Ray &ray, Float tmax, const Handle prev) const {
+        Interaction interaction(&ray);
+        interaction.object = Handle{ TYPE::MESH, 0 }; // only makes hit() respect t
+        interaction.t = tmax;
+        return hit_mesh(leaf, &interaction, prev);
+    }
+
+    /*
+        Traverses the geometry of instance i with the ray in its object space,
+        the direction isn't normalised there so t stays the world distance.
+        Fills in interaction like hit_mesh() if a triangle is closer.
+    */
+    template <bool ANY = false>
+    inline bool hit_instance(uint32_t i, Interaction * const interaction, const Handle prev) const {
+        const Instance &instance = instances[i];
+        const Ray &ray = *interaction->ray;
+        const Ray local(instance.toObject.point(ray.position), instance.toObject.vector(ray.direction));
+        Interaction inside(&local);
+        inside.object = interaction->object;
+        inside.t = interaction->t;
+        const Float tmax = inside.object.type != TYPE::NONE ? inside.t : INF;
+        const bool hit = m_blas.traverse<ANY>(local, tmax, [&](const BVHNode &node, Float &t) {
+            STAT(threadStats.meshTriangles += node.count);
+            bool closer = false;
+            for (uint32_t tri = node.offset; tri < node.offset + node.count; tri++) {
+                const Handle h{ TYPE::INSTANCE, i, tri };
+                if (prev != h && geometry.hit(tri, &inside)) {
+                    inside.object = h;
+                    closer = true;
+                }
+            }
+            if (closer)
+                t = inside.t;
+            return closer;
+        }, geometries[instance.geometry].root);
+        if (hit) {
+            interaction->object = inside.object;
+            interaction->t = inside.t;
+            interaction->uv = inside.uv;
+        }
+        return hit;
+    }
+
+    inline bool hit_instances(const Leaf &leaf, Interaction * const interaction, const Handle prev) const {
+        bool hit = false;
+        for (uint32_t i = leaf.instance; i < leaf.instance + leaf.instances; i++)
+            hit |= hit_instance(i, interaction, prev);
+        return hit;
+    }
+
+    inline bool occluded_instances(const Leaf &leaf, const Ray &ray, Float tmax, const Handle prev) const {
+        Interaction interaction(&ray);
+        interaction.object = Handle{ TYPE::INSTANCE, 0 }; // only makes hit() respect t
+        interaction.t = tmax;
+        for (uint32_t i = leaf.instance; i < leaf.instance + leaf.instances; i++) {
+            if (hit_instance<true>(i, &interaction, prev))
+                return true;
+        }
+        return false;
+    }
+
+#if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+    SphereSoA m_sphereSoA;
+    TriangleSoA m_triangleSoA;
+    PlaneSoA m_planeSoA;
+
+    static inline int64_t skip(const Handle prev, TYPE type) {
+        return prev.type == type ? int64_t(prev.index) : -1;
+    }
+
+    static inline bool set_hit(Interaction * const interaction, TYPE type, uint32_t index, Float t, const Vec3 &uv) {
+        interaction->object = Handle{ type, index };
+        interaction->t = t;
+        interaction->uv = uv;
+        return true;
+    }
+#endif
+};
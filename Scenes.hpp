@@ -0,0 +1,133 @@
+#pragma once
+#include "Scene.hpp"
+#include "Sampler.hpp"
+
+/*
+    Generated scenes. spheres_scene is what rt renders, the others are
+    canonical scenes of the benchmarks for the triangle kernels, meshes and
+    instances.
+    All of them have the ground plane at y = -1, random ones draw from rng,
+    add_lights puts a small sphere and a quad light over any of them.
+*/
+inline void spheres_scene(Scene &scene, Sampler &rng) {
+    const uint32_t ground = scene.addMaterial(GROUND);
+    const uint32_t white = scene.addMaterial(DIELECTRIC_WHITE);
+    const uint32_t gold = scene.addMaterial(DIELECTRIC_GOLD);
+
+    scene.planes.emplace_back(Vec3(0, 1, 0), -1, ground);
+
+
+    //*
+    for (int i=0; i < 100; i++) {
+        Vec3 u(0,-1,0);
+        while (u.y < 0)
+            u = random_unit_vector(rng.get2D());
+        
+        bool diffuse = (rng.get1D() < 0.5);
+        scene.spheres.emplace_back(Vec3(0,0,4) + u * 3, rng.get1D()*0.25 + 0.25, diffuse ? white : gold);
+    }
+    /*/
+    scene.spheres.emplace_back(Vec3(0,0,3), 1, gold);
+    //*/
+}
+
+// count random standalone triangles in a dome above the ground
+inline void triangles_scene(Scene &scene, Sampler &rng, int count) {
+    const uint32_t ground = scene.addMaterial(GROUND);
+    const uint32_t white = scene.addMaterial(DIELECTRIC_WHITE);
+    const uint32_t gold = scene.addMaterial(DIELECTRIC_GOLD);
+
+    scene.planes.emplace_back(Vec3(0, 1, 0), -1, ground);
+
+    for (int i = 0; i < count; i++) {
+        Vec3 u(0,-1,0);
+        while (u.y < 0)
+            u = random_unit_vector(rng.get2D());
+        const Vec3 P = Vec3(0,0,4) + u * (2 + rng.get1D());
+        const Vec3 a = random_unit_vector(rng.get2D()) * 0.4;
+        Vec3 b = random_unit_vector(rng.get2D()) * 0.4;
+        // facing the camera, only front faces are hit
+        if (a.cross(b).dot(P - Vec3(0, 0, -0.5)) > 0)
+            b = -b;
+        scene.triangles.emplace_back(P, a, b, rng.get1D() < 0.5 ? white : gold);
+    }
+}
+
+// smooth torus of n x m quads around center in the xz plane, radii 1.2 and 0.45
+inline Mesh torus_mesh(int n, int m, const Vec3 &center) {
+    const Float R = 1.2, r = 0.45;
+    Mesh torus;
+    for (int i = 0; i < n; i++) {
+        const Float a = TWO_PI * i / n;
+        for (int j = 0; j < m; j++) {
+            const Float b = TWO_PI * j / m;
+            const Vec3 N(std::cos(a) * std::cos(b), std::sin(b), std::sin(a) * std::cos(b));
+            torus.vertices.push_back(center + Vec3(R * std::cos(a), 0, R * std::sin(a)) + N * r);
+            torus.normals.push_back(N);
+        }
+    }
+    auto index = [&](int i, int j) { return uint32_t((i % n) * m + j % m); };
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < m; j++) {
+            const uint32_t quad[4] = { index(i, j), index(i, j+1), index(i+1, j+1), index(i+1, j) };
+            torus.indices.insert(torus.indices.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+        }
+    }
+    return torus;
+}
+
+// torus mesh of n x m quads lying on the ground
+inline void torus_scene(Scene &scene, int n, int m) {
+    const uint32_t ground = scene.addMaterial(GROUND);
+    const uint16_t white = scene.addMaterial(DIFFUSE_WHITE);
+
+    scene.planes.emplace_back(Vec3(0, 1, 0), -1, ground);
+    scene.mesh.append(torus_mesh(n, m, Vec3(0, -1 + Float(0.45), 3)), white);
+}
+
+/*
+    count instances of one geometry made from asset standing on the ground
+    behind the spheres, in a jittered grid with random yaw and sizes between
+    0.4 and 0.8 of the asset fitted into a unit cube. Every other one gets
+    material M2 instead of the asset's M.
+*/
+inline void add_instances(Scene &scene, Sampler &rng, const Mesh &asset, uint16_t M, uint16_t M2, int count) {
+    AABB b;
+    for (const Vec3 &v : asset.vertices)
+        b.extend(v);
+    const uint32_t geometry = scene.addGeometry(asset, M);
+    const Float fit = 1 / b.extent().max();
+    const Vec3 c = b.center();
+    const int side = std::max(1, int(std::ceil(std::sqrt(Float(count)))));
+    for (int i = 0; i < count; i++) {
+        const Float size = (Float(0.4) + Float(0.4) * rng.get1D()) * fit;
+        const Float x = -8 + 16 * ((i % side) + rng.get1D()) / side;
+        const Float z = 5 + 25 * ((i / side) + rng.get1D()) / side;
+        const Transform T = Transform::translate(Vec3(x, -1 - (b.min.y - c.y) * size, z))
+                          * Transform::rotate(Vec3(0, 1, 0), TWO_PI * rng.get1D())
+                          * Transform::scale(size)
+                          * Transform::translate(-c);
+        scene.instances.emplace_back(geometry, T, i % 2 ? M2 : Instance::OWN_MATERIAL);
+    }
+}
+
+// a field of count tori sharing one geometry
+inline void instances_scene(Scene &scene, Sampler &rng, int count) {
+    const uint32_t ground = scene.addMaterial(GROUND);
+    const uint16_t white = scene.addMaterial(DIFFUSE_WHITE);
+    const uint32_t gold = scene.addMaterial(DIELECTRIC_GOLD);
+
+    scene.planes.emplace_back(Vec3(0, 1, 0), -1, ground);
+    add_instances(scene, rng, torus_mesh(48, 24, Vec3(0)), white, gold, count);
+}
+
+// a small sphere light on the ground and a quad light facing down, both in front of the generated scenes
+inline void add_lights(Scene &scene) {
+    const uint32_t light = scene.addMaterial(LIGHT_WARM);
+
+    scene.spheres.emplace_back(Vec3(-1.5, -0.8, 1.6), 0.2, light);
+
+    const Vec3 P(-0.5, 1.6, 0.2), U(1, 0, 0), V(0, 0, 0.7); // U x V points down
+    scene.triangles.emplace_back(P, U, V, light);
+    scene.triangles.emplace_back(P + U + V, -U, -V, light);
+}
@@ -0,0 +1,250 @@
+#include "Server.hpp"
+#include "Socket.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <poll.h>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x52545356; // "RTSV"
+constexpr uint32_t VERSION = 1;
+
+/*
+    Every message is a Header followed by size bytes of payload.
+    JOB (client): JobMessage, any number of them on one connection
+    TILE (server): TileMessage and w*h Vec3
+    DONE (server): DoneMessage after the last tile of a job
+*/
+enum Type : uint32_t { JOB, TILE, DONE };
+
+struct JobMessage {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pixelSize; // sizeof(Vec3), both sides copy them as they are in memory
+    RenderJob job;
+};
+
+struct TileMessage {
+    uint32_t job;
+    int32_t x, y, w, h; // in the frame
+};
+
+struct DoneMessage {
+    uint32_t job;
+    uint32_t tiles;
+    double ms; // from receiving the job to its last tile
+};
+
+struct Client {
+    int fd;
+    std::mutex send; // render threads send tiles of the same client
+    std::atomic<bool> closed{ false };
+    MessageBuffer received{ sizeof(JobMessage) }; // only read by the serving loop
+
+    explicit Client(int fd) : fd(fd) {}
+    ~Client() { close(fd); }
+};
+
+// a job in flight, shared by its tiles
+struct Job {
+    std::shared_ptr<Client> client;
+    RenderJob request;
+    std::atomic<uint32_t> remaining;
+    uint32_t tiles;
+    std::chrono::steady_clock::time_point start;
+};
+
+struct Work {
+    std::shared_ptr<Job> job;
+    Task task;
+};
+
+bool valid(const JobMessage &m) {
+    const RenderJob &j = m.job;
+    return m.magic == MAGIC && m.version == VERSION && m.pixelSize == sizeof(Vec3)
+        && j.width > 0 && j.height > 0 && j.block > 0 && j.samples > 0 && j.w > 0 && j.h > 0
+        && j.x >= 0 && j.y >= 0 && int64_t(j.x) + j.w <= j.width && int64_t(j.y) + j.h <= j.height;
+}
+
+}
+
+bool serve(const std::string &address, int threads,
+           const std::function<void(const RenderJob&, const Task&, int, Vec3*)> &render,
+           const std::atomic<bool> &stop) {
+    const int server = open_socket(address, true);
+    if (server < 0) {
+        std::cerr << address << ": can't listen\n";
+        return false;
+    }
+    std::cout << "serving on " << address << " with " << threads << " threads" << std::endl;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<Work> queue;
+    bool finished = false;
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&, t]() {
+            std::vector<Vec3> pixels;
+            while (true) {
+                std::unique_lock<std::mutex> l(lock);
+                wake.wait(l, [&]() { return finished || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                Work work = std::move(queue.front());
+                queue.pop_front();
+                l.unlock();
+
+                Job &job = *work.job;
+                Client &client = *job.client;
+                if (client.closed)
+                    continue;
+                const Task &task = work.task;
+                pixels.resize(size_t(task.w) * task.h);
+                render(job.request, task, t, pixels.data());
+
+                std::lock_guard<std::mutex> s(client.send);
+                const TileMessage tile{ job.request.id, task.x, task.y, task.w, task.h };
+                if (!send_message(client.fd, TILE, &tile, sizeof(tile), pixels.data(), pixels.size() * sizeof(Vec3)))
+                    client.closed = true;
+                else if (--job.remaining == 0) {
+                    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.start).count();
+                    const DoneMessage done{ job.request.id, job.tiles, ms };
+                    if (!send_message(client.fd, DONE, &done, sizeof(done)))
+                        client.closed = true;
+                    std::cout << "job " << job.request.id << ": " << job.request.w << "x" << job.request.h << " pixels in "
+                              << job.tiles << " tiles at " << job.request.samples << " spp, " << ms << "ms" << std::endl;
+                }
+            }
+        });
+    }
+
+    // splits a job into tiles behind the ones already queued
+    auto enqueue = [&](const std::shared_ptr<Client> &client, const RenderJob &r) {
+        const std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->client = client;
+        job->request = r;
+        job->start = std::chrono::steady_clock::now();
+        std::vector<Task> tasks;
+        for (int y = r.y; y < r.y + r.h; y += r.block) {
+            for (int x = r.x; x < r.x + r.w; x += r.block)
+                tasks.emplace_back(x, y, std::min<int>(r.block, r.x + r.w - x), std::min<int>(r.block, r.y + r.h - y), nullptr);
+        }
+        job->tiles = tasks.size();
+        job->remaining = tasks.size();
+        {
+            std::lock_guard<std::mutex> l(lock);
+            for (const Task &task : tasks)
+                queue.push_back({ job, task });
+        }
+        wake.notify_all();
+    };
+
+    // the connections are only read here, the render threads only write to them
+    std::vector<std::shared_ptr<Client>> clients;
+    while (!stop) {
+        std::vector<pollfd> fds{ { server, POLLIN, 0 } };
+        for (const std::shared_ptr<Client> &c : clients)
+            fds.push_back({ c->fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), 500) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(server, nullptr, nullptr);
+            if (fd >= 0)
+                clients.push_back(std::make_shared<Client>(fd));
+        }
+
+        for (size_t i = fds.size() - 1; i > 0; i--) {
+            if (!fds[i].revents)
+                continue;
+            // a client that stops in the middle of a job just keeps its partial message
+            const std::shared_ptr<Client> client = clients[i - 1];
+            const bool open = client->received.receive(client->fd);
+            bool ok = true;
+            Header header;
+            const char *payload;
+            while (ok && client->received.next(header, payload)) {
+                JobMessage m;
+                ok = header.type == JOB && header.size == sizeof(m);
+                if (ok) {
+                    memcpy(&m, payload, sizeof(m));
+                    client->received.pop();
+                }
+                if (ok && !valid(m)) {
+                    std::cerr << "client " << client->fd << ": invalid job, disconnected\n";
+                    ok = false;
+                }
+                if (ok)
+                    enqueue(client, m.job);
+            }
+            if (!open || !ok) {
+                // its queued tiles see the flag and the last one closes the socket
+                client->closed = true;
+                clients.erase(clients.begin() + (i - 1));
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        finished = true;
+        queue.clear();
+    }
+    wake.notify_all();
+    for (std::thread &t : pool)
+        t.join();
+    clients.clear();
+    close_listener(server, address);
+    return true;
+}
+
+bool submit(const std::string &address, const RenderJob &job,
+            const std::function<void(const Task&, const Vec3*)> &tile) {
+    const int fd = open_socket(address, false);
+    if (fd < 0) {
+        std::cerr << address << ": can't connect\n";
+        return false;
+    }
+
+    const JobMessage m{ MAGIC, VERSION, sizeof(Vec3), job };
+    bool done = send_message(fd, JOB, &m, sizeof(m));
+    std::vector<Vec3> pixels;
+    while (done) {
+        Header header;
+        TileMessage t;
+        if (!recv_all(fd, &header, sizeof(header))) {
+            done = false;
+        }
+        else if (header.type == DONE) {
+            DoneMessage d;
+            done = header.size == sizeof(d) && recv_all(fd, &d, sizeof(d)) && d.job == job.id;
+            break;
+        }
+        else {
+            done = header.type == TILE && header.size >= sizeof(t) && recv_all(fd, &t, sizeof(t)) && t.job == job.id
+                && t.w > 0 && t.h > 0 && t.x >= job.x && t.y >= job.y && t.x + t.w <= job.x + job.w && t.y + t.h <= job.y + job.h
+                && header.size - sizeof(t) == size_t(t.w) * t.h * sizeof(Vec3);
+            if (done) {
+                pixels.resize(size_t(t.w) * t.h);
+                done = recv_all(fd, pixels.data(), pixels.size() * sizeof(Vec3));
+            }
+            if (done)
+                tile(Task(t.x - job.x, t.y - job.y, t.w, t.h, nullptr), pixels.data());
+        }
+    }
+    close(fd);
+
+    if (!done)
+        std::cerr << address << ": job rejected or connection lost\n";
+    return done;
+}
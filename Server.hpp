@@ -0,0 +1,46 @@
+#pragma once
+#include "JobList.hpp"
+#include "Transform.hpp"
+#include <atomic>
+#include <functional>
+#include <string>
+#include <cstdint>
+
+/*
+    A render server keeps the scene, its BVH and a pool of render threads
+    resident and renders jobs sent by clients over a socket (see Socket.hpp for
+    addresses), so a client pays neither process startup nor scene setup.
+    The region of a job is split into tiles of block pixels, every finished tile
+    goes back to its client right away as the linear mean of its pixels. Jobs
+    from all clients share the pool in the order they arrived. Tiles of a
+    client that disconnects are dropped.
+*/
+struct RenderJob {
+    uint32_t id;             // echoed back, for clients with several jobs in flight
+    uint32_t width, height;  // of the whole frame
+    int32_t x, y, w, h;      // the region to render
+    uint32_t block;
+    uint32_t samples;
+    uint32_t seed;
+    uint32_t sampler;        // Sampler::Type
+    Transform camera;        // Camera::toWorld
+};
+
+/*
+    Serves jobs on address with `threads` render threads until stop is set.
+    render(job, task, thread, pixels) renders the tile task of job into its
+    task.w * task.h pixels. Prints the reason and returns false if it can't
+    listen.
+*/
+bool serve(const std::string &address, int threads,
+           const std::function<void(const RenderJob&, const Task&, int, Vec3*)> &render,
+           const std::atomic<bool> &stop);
+
+/*
+    Sends job to the server at address and calls tile(task, pixels) for every
+    tile as it comes back, pixels holds the linear means of task.w * task.h
+    pixels and task is relative to the region. Prints the reason and returns
+    false if the server can't be reached or rejects the job.
+*/
+bool submit(const std::string &address, const RenderJob &job,
+            const std::function<void(const Task&, const Vec3*)> &tile);
@@ -0,0 +1,134 @@
+#pragma once
+#include "defines.hpp"
+
+/*
+    Thin wrapper over the SIMD registers used by the packet kernels.
+    Chosen at build time via RT_SIMD_AVX2 / RT_SIMD_SSE, see CMakeLists.txt.
+    Masks are kept in float registers like the intrinsics do.
+*/
+#if defined(RT_SIMD_AVX2)
+#include <immintrin.h>
+
+constexpr int LANES = 8;
+
+struct FloatN {
+    __m256 v;
+
+    FloatN() = default;
+    FloatN(__m256 x) : v(x) {}
+    explicit FloatN(Float s) : v(_mm256_set1_ps(s)) {}
+
+    static inline FloatN load(const Float *p) { return _mm256_loadu_ps(p); }
+    static inline FloatN index() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    inline void store(Float *p) const { _mm256_storeu_ps(p, v); }
+
+    inline FloatN operator+(const FloatN &o) const { return _mm256_add_ps(v, o.v); }
+    inline FloatN operator-(const FloatN &o) const { return _mm256_sub_ps(v, o.v); }
+    inline FloatN operator*(const FloatN &o) const { return _mm256_mul_ps(v, o.v); }
+    inline FloatN operator/(const FloatN &o) const { return _mm256_div_ps(v, o.v); }
+
+    inline FloatN operator<(const FloatN &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+    inline FloatN operator<=(const FloatN &o) const { return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ); }
+    inline FloatN operator>(const FloatN &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GT_OQ); }
+    inline FloatN operator>=(const FloatN &o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+    inline FloatN operator==(const FloatN &o) const { return _mm256_cmp_ps(v, o.v, _CMP_EQ_OQ); }
+    inline FloatN operator&(const FloatN &o) const { return _mm256_and_ps(v, o.v); }
+    inline FloatN operator|(const FloatN &o) const { return _mm256_or_ps(v, o.v); }
+
+    inline int mask() const { return _mm256_movemask_ps(v); }
+};
+
+inline FloatN select(const FloatN &m, const FloatN &a, const FloatN &b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline FloatN andnot(const FloatN &m, const FloatN &a) { return _mm256_andnot_ps(m.v, a.v); }
+inline FloatN sqrt(const FloatN &a) { return _mm256_sqrt_ps(a.v); }
+inline FloatN min(const FloatN &a, const FloatN &b) { return _mm256_min_ps(a.v, b.v); }
+inline FloatN max(const FloatN &a, const FloatN &b) { return _mm256_max_ps(a.v, b.v); }
+inline FloatN abs(const FloatN &a) { return andnot(FloatN(-0.0f), a); }
+
+// e^x for x <= 0, 2^fraction by its Taylor polynomial, relative error below 2e-4
+inline FloatN exp(const FloatN &x) {
+    const __m256 y = _mm256_max_ps(_mm256_mul_ps(x.v, _mm256_set1_ps(1.44269504f)), _mm256_set1_ps(-126));
+    const __m256 i = _mm256_floor_ps(y);
+    const __m256 f = _mm256_sub_ps(y, i);
+    __m256 p = _mm256_set1_ps(1.33335581e-3f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.61812911e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.55041087e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.40226507e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.93147181e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1));
+    const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(i), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+inline Float hmin(const FloatN &a) {
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(m);
+}
+
+#elif defined(RT_SIMD_SSE)
+#include <smmintrin.h>
+
+constexpr int LANES = 4;
+
+struct FloatN {
+    __m128 v;
+
+    FloatN() = default;
+    FloatN(__m128 x) : v(x) {}
+    explicit FloatN(Float s) : v(_mm_set1_ps(s)) {}
+
+    static inline FloatN load(const Float *p) { return _mm_loadu_ps(p); }
+    static inline FloatN index() { return _mm_setr_ps(0, 1, 2, 3); }
+    inline void store(Float *p) const { _mm_storeu_ps(p, v); }
+
+    inline FloatN operator+(const FloatN &o) const { return _mm_add_ps(v, o.v); }
+    inline FloatN operator-(const FloatN &o) const { return _mm_sub_ps(v, o.v); }
+    inline FloatN operator*(const FloatN &o) const { return _mm_mul_ps(v, o.v); }
+    inline FloatN operator/(const FloatN &o) const { return _mm_div_ps(v, o.v); }
+
+    inline FloatN operator<(const FloatN &o) const { return _mm_cmplt_ps(v, o.v); }
+    inline FloatN operator<=(const FloatN &o) const { return _mm_cmple_ps(v, o.v); }
+    inline FloatN operator>(const FloatN &o) const { return _mm_cmpgt_ps(v, o.v); }
+    inline FloatN operator>=(const FloatN &o) const { return _mm_cmpge_ps(v, o.v); }
+    inline FloatN operator==(const FloatN &o) const { return _mm_cmpeq_ps(v, o.v); }
+    inline FloatN operator&(const FloatN &o) const { return _mm_and_ps(v, o.v); }
+    inline FloatN operator|(const FloatN &o) const { return _mm_or_ps(v, o.v); }
+
+    inline int mask() const { return _mm_movemask_ps(v); }
+};
+
+inline FloatN select(const FloatN &m, const FloatN &a, const FloatN &b) { return _mm_blendv_ps(b.v, a.v, m.v); }
+inline FloatN andnot(const FloatN &m, const FloatN &a) { return _mm_andnot_ps(m.v, a.v); }
+inline FloatN sqrt(const FloatN &a) { return _mm_sqrt_ps(a.v); }
+inline FloatN min(const FloatN &a, const FloatN &b) { return _mm_min_ps(a.v, b.v); }
+inline FloatN max(const FloatN &a, const FloatN &b) { return _mm_max_ps(a.v, b.v); }
+inline FloatN abs(const FloatN &a) { return andnot(FloatN(-0.0f), a); }
+
+// e^x for x <= 0, 2^fraction by its Taylor polynomial, relative error below 2e-4
+inline FloatN exp(const FloatN &x) {
+    const __m128 y = _mm_max_ps(_mm_mul_ps(x.v, _mm_set1_ps(1.44269504f)), _mm_set1_ps(-126));
+    const __m128 i = _mm_floor_ps(y);
+    const __m128 f = _mm_sub_ps(y, i);
+    __m128 p = _mm_set1_ps(1.33335581e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1));
+    const __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(i), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+
+inline Float hmin(const FloatN &a) {
+    __m128 m = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(m);
+}
+
+#else
+
+constexpr int LANES = 1;
+
+#endif
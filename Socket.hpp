@@ -0,0 +1,166 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+    Blocking stream sockets shared by the distributed renderer and the render
+    server. Addresses of the form host:port are TCP, anything else is a Unix
+    domain socket path. Messages are a Header followed by size bytes of payload,
+    each protocol numbers its own types. A MessageBuffer reads them from many
+    sockets at once.
+*/
+struct Header {
+    uint32_t type;
+    uint32_t size;
+};
+
+inline bool send_all(int fd, const void *data, size_t size) {
+    const char *p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void *data, size_t size) {
+    char *p = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+    The bytes of one connection as they arrive, for a loop that polls many
+    connections and mustn't block on a peer that stops in the middle of a
+    message. Messages whose payload is larger than max are refused.
+*/
+class MessageBuffer {
+public:
+    explicit MessageBuffer(size_t max) : m_max(max) {}
+
+    // reads what poll() reported without blocking, false if the peer closed, failed or sent too much
+    inline bool receive(int fd) {
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+            m_data.insert(m_data.end(), chunk, chunk + n);
+            Header header;
+            if (m_data.size() >= sizeof(header)) {
+                memcpy(&header, m_data.data(), sizeof(header));
+                if (header.size > m_max)
+                    return false;
+            }
+            // at most one message past the first, the rest waits in the socket
+            if (m_data.size() > 2 * (sizeof(header) + m_max))
+                return true;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+
+    // the first message once all of it is there, its payload is size bytes at payload
+    inline bool next(Header &header, const char *&payload) const {
+        if (m_data.size() < sizeof(header))
+            return false;
+        memcpy(&header, m_data.data(), sizeof(header));
+        payload = m_data.data() + sizeof(header);
+        return m_data.size() - sizeof(header) >= header.size;
+    }
+
+    // drops the first message, which next() returned
+    inline void pop() {
+        Header header;
+        memcpy(&header, m_data.data(), sizeof(header));
+        m_data.erase(m_data.begin(), m_data.begin() + sizeof(header) + header.size);
+    }
+
+private:
+    std::vector<char> m_data;
+    size_t m_max;
+};
+
+inline bool send_message(int fd, uint32_t type, const void *data, size_t size, const void *extra = nullptr, size_t extraSize = 0) {
+    const Header header{ type, uint32_t(size + extraSize) };
+    return send_all(fd, &header, sizeof(header)) && send_all(fd, data, size) && send_all(fd, extra, extraSize);
+}
+
+// splits host:port, false for a Unix socket path
+inline bool tcp_address(const std::string &address, std::string &host, std::string &port) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos || address.find('/') != std::string::npos)
+        return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+// a listening (listen = true) or connected socket for address, -1 on failure
+inline int open_socket(const std::string &address, bool listen) {
+    std::string host, port;
+    if (!tcp_address(address, host, port)) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path))
+            return -1;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (listen)
+            unlink(address.c_str());
+        const bool ok = listen ? bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && ::listen(fd, 64) == 0
+                               : connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if (!ok) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen ? AI_PASSIVE : 0;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0)
+        return -1;
+    int fd = -1;
+    for (addrinfo *a = result; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        const bool ok = listen ? bind(fd, a->ai_addr, a->ai_addrlen) == 0 && ::listen(fd, 64) == 0
+                               : connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+// closes a listening socket, removing its file if it is a Unix socket
+inline void close_listener(int fd, const std::string &address) {
+    close(fd);
+    std::string host, port;
+    if (!tcp_address(address, host, port))
+        unlink(address.c_str());
+}
@@ -0,0 +1,61 @@
+#include "Stats.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+void Stats::merge(const Stats &s) {
+    for (int d = 0; d < DEPTHS; d++)
+        rays[d] += s.rays[d];
+    spheres += s.spheres;
+    triangles += s.triangles;
+    planes += s.planes;
+    meshTriangles += s.meshTriangles;
+    nodes += s.nodes;
+    roulette += s.roulette;
+    shadowRays += s.shadowRays;
+    tiles.insert(tiles.end(), s.tiles.begin(), s.tiles.end());
+}
+
+bool Stats::write(const std::string &path) const {
+    std::ofstream f(path);
+    if (!f) {
+        std::cerr << path << ": can't write statistics\n";
+        return false;
+    }
+
+    uint64_t total = 0;
+    int deepest = 0;
+    for (int d = 0; d < DEPTHS; d++) {
+        total += rays[d];
+        if (rays[d])
+            deepest = d + 1;
+    }
+    const double perRay = 1.0 / std::max<uint64_t>(total, 1);
+
+    f << "{\n  \"rays\": " << total << ",\n  \"raysPerDepth\": [";
+    for (int d = 0; d < deepest; d++)
+        f << (d ? ", " : "") << rays[d];
+    f << "],\n  \"primitiveTests\": { \"spheres\": " << spheres << ", \"triangles\": " << triangles
+      << ", \"planes\": " << planes << ", \"meshTriangles\": " << meshTriangles
+      << ", \"total\": " << tests() << ", \"perRay\": " << tests() * perRay << " },\n";
+    f << "  \"bvhNodes\": { \"total\": " << nodes << ", \"perRay\": " << nodes * perRay << " },\n";
+    f << "  \"rouletteTerminations\": " << roulette << ",\n";
+    f << "  \"shadowRays\": " << shadowRays << ",\n";
+
+    double sum = 0, slowest = 0, fastest = tiles.empty() ? 0 : tiles[0].ms;
+    for (const TileTime &t : tiles) {
+        sum += t.ms;
+        slowest = std::max(slowest, t.ms);
+        fastest = std::min(fastest, t.ms);
+    }
+    f << "  \"tileMs\": { \"count\": " << tiles.size() << ", \"total\": " << sum << ", \"min\": " << fastest
+      << ", \"mean\": " << sum / std::max<size_t>(tiles.size(), 1) << ", \"max\": " << slowest << " },\n";
+    f << "  \"tiles\": [";
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const TileTime &t = tiles[i];
+        f << (i ? ",\n" : "\n") << "    { \"x\": " << t.x << ", \"y\": " << t.y << ", \"w\": " << t.w << ", \"h\": " << t.h
+          << ", \"thread\": " << t.thread << ", \"ms\": " << t.ms << " }";
+    }
+    f << "\n  ]\n}\n";
+    return bool(f);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+    Ray tracing statistics, only compiled in with RT_STATS (cmake -DRT_STATS=ON),
+    STAT(x) evaluates x only then. Every thread counts into its own threadStats,
+    which adds itself to totals() when the thread exits.
+*/
+#ifdef RT_STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+
+struct TileTime {
+    int x, y, w, h;
+    int thread;
+    double ms;
+};
+
+struct Stats {
+    static constexpr int DEPTHS = 32; // the last entry counts all deeper rays
+
+    uint64_t rays[DEPTHS]{}; // rays traced per bounce depth
+    uint64_t spheres{ 0 };   // primitive tests per type
+    uint64_t triangles{ 0 };
+    uint64_t planes{ 0 };
+    uint64_t meshTriangles{ 0 };
+    uint64_t nodes{ 0 };     // BVH nodes visited
+    uint64_t roulette{ 0 };  // paths ended by Russian roulette
+    uint64_t shadowRays{ 0 }; // light sample visibility tests
+    std::vector<TileTime> tiles;
+
+    inline void ray(uint32_t depth) { rays[depth < DEPTHS ? depth : DEPTHS - 1]++; }
+    inline uint64_t tests() const { return spheres + triangles + planes + meshTriangles; }
+
+    // traversal work, what the per pixel cost counts
+    inline uint64_t work() const { return nodes + tests(); }
+
+    void merge(const Stats &s);
+
+    // JSON report, prints the reason and returns false if it can't be written
+    bool write(const std::string &path) const;
+};
+
+#ifdef RT_STATS
+inline std::mutex totalsLock;
+inline Stats &totals() {
+    static Stats s;
+    return s;
+}
+
+struct ThreadStats : Stats {
+    uint64_t *cost{ nullptr }; // work per pixel of the current tile
+    uint32_t current{ 0 };
+    uint64_t mark{ 0 };
+
+    // charges the work since the last call to the current pixel and switches to pixel p
+    inline void pixel(uint32_t p) {
+        const uint64_t w = work();
+        if (cost)
+            cost[current] += w - mark;
+        mark = w;
+        current = p;
+    }
+
+    inline void begin(uint64_t *tileCost) {
+        cost = tileCost;
+        current = 0;
+        mark = work();
+    }
+
+    inline void end() {
+        pixel(0);
+        cost = nullptr;
+    }
+
+    ~ThreadStats() {
+        std::lock_guard<std::mutex> lock(totalsLock);
+        totals().merge(*this);
+    }
+};
+
+inline thread_local ThreadStats threadStats;
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+#include "Vector.hpp"
+#include "AABB.hpp"
+
+// affine map x -> L x + translation, the linear part L stored by rows
+struct Transform {
+    Vec3 rows[3];
+    Vec3 translation;
+
+    constexpr Transform() : rows{ Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1) }, translation(0) {}
+    constexpr Transform(const Vec3 &r0, const Vec3 &r1, const Vec3 &r2, const Vec3 &t) : rows{ r0, r1, r2 }, translation(t) {}
+
+    static constexpr Transform translate(const Vec3 &t) { return Transform(Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1), t); }
+    static constexpr Transform scale(Float s) { return Transform(Vec3(s, 0, 0), Vec3(0, s, 0), Vec3(0, 0, s), Vec3(0)); }
+
+    // by angle radians around the unit vector axis
+    static inline Transform rotate(const Vec3 &axis, Float angle) {
+        const Float c = std::cos(angle), s = std::sin(angle), k = 1 - c;
+        const Vec3 &a = axis;
+        return Transform(Vec3(c + a.x*a.x*k, a.x*a.y*k - a.z*s, a.x*a.z*k + a.y*s),
+                         Vec3(a.y*a.x*k + a.z*s, c + a.y*a.y*k, a.y*a.z*k - a.x*s),
+                         Vec3(a.z*a.x*k - a.y*s, a.z*a.y*k + a.x*s, c + a.z*a.z*k),
+                         Vec3(0));
+    }
+
+    constexpr Vec3 vector(const Vec3 &v) const { return Vec3(rows[0].dot(v), rows[1].dot(v), rows[2].dot(v)); }
+    constexpr Vec3 point(const Vec3 &p) const { return vector(p) + translation; }
+    // v times the transposed linear part, the inverse of a transform maps normals out of its space like this
+    constexpr Vec3 transposed(const Vec3 &v) const { return rows[0] * v.x + rows[1] * v.y + rows[2] * v.z; }
+
+    // this after t
+    constexpr Transform operator*(const Transform &t) const {
+        const Vec3 c0 = vector(Vec3(t.rows[0].x, t.rows[1].x, t.rows[2].x));
+        const Vec3 c1 = vector(Vec3(t.rows[0].y, t.rows[1].y, t.rows[2].y));
+        const Vec3 c2 = vector(Vec3(t.rows[0].z, t.rows[1].z, t.rows[2].z));
+        return Transform(Vec3(c0.x, c1.x, c2.x), Vec3(c0.y, c1.y, c2.y), Vec3(c0.z, c1.z, c2.z), point(t.translation));
+    }
+
+    constexpr Float determinant() const { return rows[0].dot(rows[1].cross(rows[2])); }
+
+    // by the cofactors, the transform must not be singular
+    constexpr Transform inverse() const {
+        const Float inv = 1 / determinant();
+        const Vec3 c0 = rows[1].cross(rows[2]) * inv;
+        const Vec3 c1 = rows[2].cross(rows[0]) * inv;
+        const Vec3 c2 = rows[0].cross(rows[1]) * inv;
+        const Transform t(Vec3(c0.x, c1.x, c2.x), Vec3(c0.y, c1.y, c2.y), Vec3(c0.z, c1.z, c2.z), Vec3(0));
+        return Transform(t.rows[0], t.rows[1], t.rows[2], -t.vector(translation));
+    }
+
+    // box around the transformed box b (Arvo 1990)
+    constexpr AABB bounds(const AABB &b) const {
+        AABB r(translation, translation);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                const Float e = rows[i][j] * b.min[j];
+                const Float f = rows[i][j] * b.max[j];
+                set(r.min, i, r.min[i] + std::min(e, f));
+                set(r.max, i, r.max[i] + std::max(e, f));
+            }
+        }
+        return r;
+    }
+
+private:
+    static constexpr void set(Vec3 &v, int i, Float x) { (i == 0 ? v.x : (i == 1 ? v.y : v.z)) = x; }
+};
@@ -59,6 +59,11 @@ union Vec3 {
     constexpr Vec3(const Vec3 &v) : x(v.x), y(v.y), z(v.z) {}
 
     constexpr Float max() const { return std::max(std::max(x, y), z); }
+    constexpr Float min() const { return std::min(std::min(x, y), z); }
+
+    constexpr Float operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+
+    constexpr bool operator==(const Vec3 &v) const { return x == v.x && y == v.y && z == v.z; }
 
     constexpr Vec3 operator+(const Vec3 &v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
     constexpr Vec3 operator-(const Vec3 &v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
@@ -98,6 +103,14 @@ union Vec3 {
     
 };
 
+constexpr Vec3 component_min(const Vec3 &a, const Vec3 &b) {
+    return Vec3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+
+constexpr Vec3 component_max(const Vec3 &a, const Vec3 &b) {
+    return Vec3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
 constexpr Vec3 reflect_n(const Vec3 &I, const Vec3 &N) {
     return I - N * (Float(2)*N.dot(I));
 }
@@ -106,21 +119,52 @@ constexpr Vec3 reflect(const Vec3 &I, const Vec3 &N) {
     return I - N * (Float(2)*N.dot(I) / N.norm_sqr());
 }
 
-inline Vec3 random_unit_vector() {
-    const Float phi = UniRand() * PI;
-    const Float theta = UniRand() * TWO_PI;
+// area preserving map of a point in [0,1)^2 to the unit sphere
+inline Vec3 random_unit_vector(const Vec2 &s) {
+    const Float z = 1 - 2 * s.u;
+    const Float r = sqrt(std::max(Float(0), 1 - z*z));
+    const Float theta = s.v * TWO_PI;
 
-    return Vec3(sin(phi)*sin(theta), sin(phi)*cos(theta), cos(phi));
+    return Vec3(r*sin(theta), r*cos(theta), z);
 }
 
-inline Vec3 random_hemi_vector(const Vec3 &n) {
-    const Vec3 u = random_unit_vector();
+// completes the unit vector n to an orthonormal basis (Duff et al. 2017)
+inline void basis(const Vec3 &n, Vec3 &b1, Vec3 &b2) {
+    const Float sign = std::copysign(Float(1), n.z);
+    const Float a = -1 / (sign + n.z);
+    const Float b = n.x * n.y * a;
+    b1 = Vec3(1 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    b2 = Vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+inline Vec3 random_hemi_vector(const Vec3 &n, const Vec2 &s) {
+    const Vec3 u = random_unit_vector(s);
     if (n.dot(u) < 0)
         return -u;
     else
         return u;
 }
 
+// direction around the unit vector n with density cos / PI, s mapped to the disk by Shirley and Chiu's concentric map
+inline Vec3 cosine_hemi_vector(const Vec3 &n, const Vec2 &s) {
+    const Float a = 2 * s.u - 1;
+    const Float b = 2 * s.v - 1;
+    Float r = 0, phi = 0;
+    if (a * a > b * b) {
+        r = a;
+        phi = PI * Float(0.25) * (b / a);
+    }
+    else if (b != 0) {
+        r = b;
+        phi = PI * Float(0.5) - PI * Float(0.25) * (a / b);
+    }
+    const Float x = r * std::cos(phi);
+    const Float y = r * std::sin(phi);
+    Vec3 b1, b2;
+    basis(n, b1, b2);
+    return b1 * x + b2 * y + n * sqrt(std::max(Float(0), 1 - x*x - y*y));
+}
+
 
 inline std::ostream &operator<<(std::ostream &os, const Vec3 &v) {
     os << std::fixed << std::showpos << std::setprecision(2);
@@ -0,0 +1,187 @@
+#pragma once
+#include "Integrator.hpp"
+#include "Adaptive.hpp"
+#include <vector>
+
+/*
+    Breadth-first alternative to Li(). All paths of a batch advance one bounce
+    at a time: extend intersects every ray, retire gathers the light found at
+    the hits, then escaped and roulette-killed paths are retired and the
+    survivors are grouped by material before they are shaded, so each stage
+    runs over coherent work. Same estimator as Li().
+*/
+class Wavefront {
+public:
+    struct Path {
+        Ray ray;
+        Vec3 beta;      // product of the bounce weights so far
+        Vec3 L;         // light gathered so far, weighted by beta
+        Float Prr;
+        Float pdf;      // of the last bounce, see scatter()
+        Handle prev;
+        uint32_t pixel;
+        uint32_t depth;
+        bool primary;   // the first extend is done, see add() with a PrimaryHit
+        Sampler sampler;
+
+        // filled by the extend stage
+        Handle object;
+        Float t;
+        Vec3 uv;
+        uint32_t bucket;
+    };
+
+    uint64_t rays{ 0 }; // rays traced so far
+
+    // sampler has already drawn the camera dimensions of this path
+    inline void add(const Ray &ray, uint32_t pixel, const Sampler &sampler) {
+        Path &p = m_paths.emplace_back();
+        p.ray = ray;
+        p.sampler = sampler;
+        p.beta = Vec3(1);
+        p.L = Vec3(0);
+        p.Prr = 1;
+        p.pdf = 0;
+        p.pixel = pixel;
+        p.depth = 0;
+        p.primary = false;
+    }
+
+    // a path starting from the cached first hit of its camera ray
+    inline void add(const PrimaryHit &hit, uint32_t pixel, const Sampler &sampler) {
+        add(hit.ray, pixel, sampler);
+        Path &p = m_paths.back();
+        p.primary = true;
+        p.object = hit.object;
+        p.t = hit.t;
+        p.uv = hit.uv;
+    }
+
+    // traces all added paths to the end and adds each one as a sample with its features to estimates[pixel]
+    void trace(const Scene &scene, PixelEstimate * const estimates) {
+        while (!m_paths.empty()) {
+            extend(scene);
+            const size_t alive = retire(scene, estimates);
+            sort(alive);
+            shade(scene);
+            m_paths.swap(m_sorted);
+        }
+    }
+
+private:
+    std::vector<Path> m_paths;
+    std::vector<Path> m_sorted;
+    std::vector<const Material*> m_materials;
+    std::vector<uint32_t> m_offsets;
+
+    // the updated interaction of the hit extend found, refers to p.ray
+    static inline Interaction hit(const Scene &scene, const Path &p) {
+        Interaction interaction(&p.ray);
+        interaction.object = p.object;
+        interaction.t = p.t;
+        interaction.uv = p.uv;
+        scene.update(&interaction);
+        return interaction;
+    }
+
+    void extend(const Scene &scene) {
+        for (Path &p : m_paths) {
+            if (p.depth >= BOUNCES) {
+                p.object = Handle();
+                continue;
+            }
+            if (p.depth == 0 && p.primary)
+                continue;
+            Interaction interaction(&p.ray);
+            rays++;
+            STAT(threadStats.pixel(p.pixel));
+            STAT(threadStats.ray(p.depth));
+            scene.intersect(&interaction, p.prev);
+            p.object = interaction.object;
+            p.t = interaction.t;
+            p.uv = interaction.uv;
+        }
+    }
+
+    // adds emission and a light sample, compacts the surviving paths to the front and counts them per material
+    size_t retire(const Scene &scene, PixelEstimate * const estimates) {
+        m_materials.clear();
+        m_offsets.clear();
+
+        size_t alive = 0;
+        for (Path &p : m_paths) {
+            if (p.object.type == TYPE::NONE) {
+                estimates[p.pixel].add(p.L + p.beta * AMBIENT);
+                continue;
+            }
+
+            const Material *material = scene.material(p.object);
+            if (material->emissive())
+                p.L += p.beta * emitted(scene, p.ray, p.object, p.t, *material, p.pdf);
+            if (p.depth == 0 || !scene.lights.empty()) {
+                const Interaction interaction = hit(scene, p);
+                if (p.depth == 0)
+                    estimates[p.pixel].features += features(interaction, *material);
+                if (!scene.lights.empty()) {
+                    STAT(threadStats.pixel(p.pixel));
+                    p.L += p.beta * direct(scene, interaction, *material, p.sampler);
+                }
+            }
+
+            if (p.sampler.get1D() >= p.Prr) {
+                STAT(threadStats.roulette++);
+                estimates[p.pixel].add(p.L);
+                continue;
+            }
+
+            uint32_t bucket = 0;
+            while (bucket < m_materials.size() && m_materials[bucket] != material)
+                bucket++;
+            if (bucket == m_materials.size()) {
+                m_materials.push_back(material);
+                m_offsets.push_back(0);
+            }
+            m_offsets[bucket]++;
+
+            p.bucket = bucket;
+            m_paths[alive++] = p;
+        }
+        m_paths.resize(alive);
+        return alive;
+    }
+
+    // counting sort by material bucket into m_sorted
+    void sort(size_t alive) {
+        uint32_t sum = 0;
+        for (uint32_t &offset : m_offsets) {
+            const uint32_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        m_sorted.resize(alive);
+        for (const Path &p : m_paths)
+            m_sorted[m_offsets[p.bucket]++] = p;
+    }
+
+    // each material's paths are in one run of m_sorted, scattered by code specialised for its BxDF
+    void shade(const Scene &scene) {
+        uint32_t begin = 0;
+        for (size_t bucket = 0; bucket < m_materials.size(); bucket++) {
+            const uint32_t end = m_offsets[bucket];
+            m_materials[bucket]->visit([&](const auto &bxdf) {
+                for (uint32_t i = begin; i < end; i++) {
+                    Path &p = m_sorted[i];
+                    Interaction interaction = hit(scene, p);
+                    Vec3 color;
+                    const Ray r = scatter(bxdf, interaction, p.Prr, color, p.pdf, p.sampler);
+                    p.beta = p.beta * color;
+                    p.Prr = p.Prr * color.max();
+                    p.prev = p.object;
+                    p.ray = r;
+                    p.depth++;
+                }
+            });
+            begin = end;
+        }
+    }
+};
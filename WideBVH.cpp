@@ -0,0 +1,84 @@
+#include "WideBVH.hpp"
+#include <algorithm>
+#include <cmath>
+
+void WideBVH::build(const BVH &bvh) {
+    nodes.clear();
+    bounds = AABB();
+    if (bvh.empty())
+        return;
+    bounds = bvh.nodes[0].bounds;
+    nodes.reserve(bvh.nodes.size() / 3 + 1);
+    collapse(bvh, 0);
+}
+
+// the wide node of BVH node index, its children come after it
+uint32_t WideBVH::collapse(const BVH &bvh, uint32_t index) {
+    constexpr int WIDTH = WideNode::WIDTH;
+    const BVHNode &root = bvh.nodes[index];
+
+    // opens the inner child with the largest area while there is room
+    uint32_t children[WIDTH];
+    int n = 0;
+    if (root.leaf())
+        children[n++] = index;
+    else {
+        children[n++] = index + 1;
+        children[n++] = root.offset;
+    }
+    while (n < WIDTH) {
+        int widest = -1;
+        Float area = -1;
+        for (int i = 0; i < n; i++) {
+            const BVHNode &c = bvh.nodes[children[i]];
+            if (!c.leaf() && c.bounds.area() > area) {
+                widest = i;
+                area = c.bounds.area();
+            }
+        }
+        if (widest < 0)
+            break;
+        const uint32_t c = children[widest];
+        children[widest] = c + 1;
+        children[n++] = bvh.nodes[c].offset;
+    }
+
+    WideNode node{};
+    node.origin = root.bounds.min;
+    node.children = n;
+    Float step[3];
+    for (int a = 0; a < 3; a++) {
+        // the smallest power of two that covers the extent in 255 steps
+        int e = -126;
+        const Float extent = root.bounds.max[a] - root.bounds.min[a];
+        if (extent > 0)
+            std::frexp(extent / 255, &e);
+        node.exponent[a] = std::clamp(e, -126, 127);
+        step[a] = WideNode::step(node.exponent[a]);
+    }
+    for (int i = 0; i < n; i++) {
+        const AABB &b = bvh.nodes[children[i]].bounds;
+        for (int a = 0; a < 3; a++) {
+            // rounded outwards, also where the decoding rounds
+            const Float o = node.origin[a], s = step[a];
+            int lo = std::clamp(int(std::floor((b.min[a] - o) / s)), 0, 255);
+            int hi = std::clamp(int(std::ceil((b.max[a] - o) / s)), 0, 255);
+            while (lo > 0 && o + lo * s > b.min[a])
+                lo--;
+            while (hi < 255 && o + hi * s < b.max[a])
+                hi++;
+            node.lo[a][i] = lo;
+            node.hi[a][i] = hi;
+        }
+    }
+
+    const uint32_t w = nodes.size();
+    nodes.push_back(node);
+    for (int i = 0; i < n; i++) {
+        const BVHNode &c = bvh.nodes[children[i]];
+        const uint32_t child = c.leaf() ? c.offset : collapse(bvh, children[i]);
+        nodes[w].child[i] = child;
+        nodes[w].count[i] = c.leaf() ? c.count : 0;
+    }
+    return w;
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include "BVH.hpp"
+#include "Simd.hpp"
+#include <vector>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+/*
+    Four children per node, one cache line: the node stores its box as an
+    origin and a power of two step per axis, the children's boxes as 8 bit
+    multiples of the step, rounded outwards. Decoding the children is cheaper
+    than fetching their boxes, and a ray touches a quarter of the cache lines
+    the binary BVH costs it. Built by collapsing a BVH: every node takes the
+    inner descendant with the largest surface area apart until it has four
+    children. Leaves stay the BVH's leaves.
+*/
+struct alignas(64) WideNode {
+    static constexpr int WIDTH = 4;
+
+    Vec3 origin;
+    int8_t exponent[3];     // a step of 2^exponent
+    uint8_t children;       // used, the first ones
+    uint8_t lo[3][WIDTH];   // by axis, then child
+    uint8_t hi[3][WIDTH];
+    uint32_t child[WIDTH];  // inner: node index, leaf: offset of the BVH leaf
+    uint16_t count[WIDTH];  // leaf: count of the BVH leaf, 0 for an inner child
+
+    // bit i set if [0, tmax] enters the box of child i, at t[i]
+    inline int hit(const Vec3 &position, const Vec3 &inv_dir, Float tmax, Float t[WIDTH]) const {
+        // a child's plane is at (q * step + offset) * inv_dir, the way AABB::hit has it: folding
+        // the step into inv_dir gives 0 * inf = NaN for axis aligned rays, which min and max pass on
+        Float st[3], offset[3];
+        for (int a = 0; a < 3; a++) {
+            st[a] = step(exponent[a]);
+            offset[a] = origin[a] - position[a];
+        }
+    #if defined(RT_SIMD_AVX2) || defined(RT_SIMD_SSE)
+        __m128 tn = _mm_setzero_ps(), tf = _mm_set1_ps(tmax);
+        for (int a = 0; a < 3; a++) {
+            const __m128 s = _mm_set1_ps(st[a]), o = _mm_set1_ps(offset[a]), inv = _mm_set1_ps(inv_dir[a]);
+            const __m128 l = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(load(lo[a]))));
+            const __m128 h = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(load(hi[a]))));
+            const __m128 t0 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(l, s), o), inv);
+            const __m128 t1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(h, s), o), inv);
+            tn = _mm_max_ps(tn, _mm_min_ps(t0, t1));
+            tf = _mm_min_ps(tf, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(t, tn);
+        return _mm_movemask_ps(_mm_cmple_ps(tn, tf)) & ((1 << children) - 1);
+    #else
+        int mask = 0;
+        for (int i = 0; i < children; i++) {
+            Float tn = 0, tf = tmax;
+            for (int a = 0; a < 3; a++) {
+                const Float t0 = (lo[a][i] * st[a] + offset[a]) * inv_dir[a];
+                const Float t1 = (hi[a][i] * st[a] + offset[a]) * inv_dir[a];
+                tn = std::max(tn, std::min(t0, t1));
+                tf = std::min(tf, std::max(t0, t1));
+            }
+            t[i] = tn;
+            mask |= (tn <= tf) << i;
+        }
+        return mask;
+    #endif
+    }
+
+    // 2^e for e in [-126, 127]
+    static inline float step(int e) { return std::bit_cast<float>(uint32_t(e + 127) << 23); }
+
+private:
+    static inline int load(const uint8_t *p) {
+        int v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+};
+static_assert(sizeof(WideNode) == 64, "a node is one cache line");
+
+class WideBVH {
+public:
+    static constexpr int STACK_SIZE = 256;
+
+    std::vector<WideNode> nodes;
+    AABB bounds; // of the root, exact
+
+    // collapses bvh, whose leaves keep their offset and count
+    void build(const BVH &bvh);
+
+    inline bool empty() const { return nodes.empty(); }
+    inline size_t bytes() const { return nodes.size() * sizeof(WideNode); }
+
+    /*
+        Same as BVH::traverse, except that only the offset and count of the
+        leaf node intersect() gets are filled in. Children are visited near
+        to far, the ones behind a hit found meanwhile are skipped.
+    */
+    template <bool ANY = false, typename F>
+    bool traverse(const Ray &ray, Float tmax, F &&intersect) const {
+        if (nodes.empty())
+            return false;
+
+        const Vec3 inv_dir(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+        if (bounds.hit(ray.position, inv_dir, tmax) == INF)
+            return false;
+
+        struct Entry {
+            uint32_t child;
+            uint16_t count; // 0: child is a node
+            Float t;
+        };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, 0, 0 };
+        bool found = false;
+
+        while (top > 0) {
+            const Entry entry = stack[--top];
+            if (entry.t > tmax)
+                continue;
+            if (entry.count) {
+                const BVHNode leaf{ AABB(), entry.child, entry.count, 0 };
+                if (intersect(leaf, tmax)) {
+                    if constexpr (ANY)
+                        return true;
+                    found = true;
+                }
+                continue;
+            }
+
+            const WideNode &node = nodes[entry.child];
+            STAT(threadStats.nodes++);
+            Float t[WideNode::WIDTH];
+            int mask = node.hit(ray.position, inv_dir, tmax, t);
+
+            // pushed far to near, so the nearest child comes off the stack first
+            const int first = top;
+            while (mask) {
+                const int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+                int j = top++;
+                for (; j > first && stack[j - 1].t < t[i]; j--)
+                    stack[j] = stack[j - 1];
+                stack[j] = { node.child[i], node.count[i], t[i] };
+            }
+        }
+
+        return found;
+    }
+
+private:
+    uint32_t collapse(const BVH &bvh, uint32_t index);
+};